@@ -0,0 +1,90 @@
+/*
+ * Completion latency: times complete_word on file names in a directory
+ * of many entries, the first Tab (which lists and sorts the directory)
+ * and the following ones (answered from the cached index), and on
+ * command names from the PATH trie. A frame at 60 Hz is 16.7 ms.
+ *
+ *     gcc -O2 bench/complete.c -o completebench -pthread
+ *     ./completebench [entries] [rounds]
+ */
+#define main shellfyre_main
+#include "../main.c"
+#undef main
+
+static double seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Completes each line once per round and prints the distribution.
+ */
+static void bench_lines(const char *what, const char **lines, int line_count, int rounds)
+{
+    double *us = malloc(sizeof(double) * rounds * line_count);
+    char insert[PATH_MAX];
+    int n = 0;
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < line_count; ++i) {
+            double start = seconds();
+            complete_word(lines[i], strlen(lines[i]), insert, sizeof(insert), 0);
+            us[n++] = (seconds() - start) * 1e6;
+        }
+    }
+    qsort(us, n, sizeof(double), compare_double);
+    printf("%-22s median %8.1f us, p99 %8.1f us, max %8.1f us\n", what, us[n / 2], us[n * 99 / 100],
+           us[n - 1]);
+    free(us);
+}
+
+int main(int argc, char **argv)
+{
+    int entries = argc > 1 ? atoi(argv[1]) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 1000;
+    if (entries < 1)
+        entries = 100000;
+    if (rounds < 1)
+        rounds = 1000;
+
+    char dir[] = "/tmp/completebench.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) == -1) {
+        perror(dir);
+        return 1;
+    }
+    char name[32];
+    for (int i = 0; i < entries; ++i) {
+        snprintf(name, sizeof(name), "file%06d", i);
+        int fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd == -1) {
+            perror(name);
+            return 1;
+        }
+        close(fd);
+    }
+    mkdir("subdir", 0755);
+
+    const char *files[] = {"cat file0123", "cat file09", "cat file", "cat sub", "cat x"};
+    const char *commands[] = {"g", "gre", "pyth", "filese", "xyzzy"};
+    printf("%d entries\n", entries);
+    bench_lines("first Tab", files, 1, 1);
+    bench_lines("files", files, sizeof(files) / sizeof(*files), rounds);
+    bench_lines("first command", commands, 1, 1);
+    bench_lines("commands", commands, sizeof(commands) / sizeof(*commands), rounds);
+
+    for (int i = 0; i < entries; ++i) {
+        snprintf(name, sizeof(name), "file%06d", i);
+        unlink(name);
+    }
+    rmdir("subdir");
+    if (chdir("/") == 0)
+        rmdir(dir);
+    return 0;
+}
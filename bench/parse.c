@@ -0,0 +1,95 @@
+/*
+ * Parser throughput: parses every line of a corpus of command lines over
+ * and over, releasing each result with free_command like the shell does,
+ * and prints lines per second. Without a file a small built in corpus is
+ * used; a shell history file makes a good one.
+ *
+ *     gcc -O2 bench/parse.c -o parsebench -pthread
+ *     ./parsebench [corpus] [seconds]
+ */
+#define main shellfyre_main
+#include "../main.c"
+#undef main
+
+static const char *builtin_corpus[] = {
+    "ls -la",
+    "cd /var/log",
+    "grep -i error syslog | sort | uniq -c | sort -rn | head -20",
+    "cat access.log | cut -d ' ' -f 1 | sort | uniq -c > hits.txt",
+    "find . -name '*.c' | xargs wc -l",
+    "make -j8 2> build.err",
+    "tar czf backup.tar.gz /home/user/projects &",
+    "awk '{ sum += $5 } END { print sum }' report.csv >> totals.txt",
+    "git log --oneline --graph --decorate --all",
+    "ps aux | grep shellfyre | grep -v grep",
+    "filesearch -r -o main",
+    "cdh",
+    "echo \"hello world\" > greeting.txt",
+    "sed -e 's/foo/bar/g' input.txt | tee output.txt | wc -l",
+    "sort < names.txt > sorted.txt",
+};
+
+static double seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    char **lines = (char **)builtin_corpus;
+    size_t count = sizeof(builtin_corpus) / sizeof(*builtin_corpus), bytes = 0;
+    double duration = argc > 2 ? atof(argv[2]) : 2;
+
+    if (argc > 1) {
+        FILE *f = fopen(argv[1], "r");
+        if (!f) {
+            perror(argv[1]);
+            return 1;
+        }
+        size_t cap = 0;
+        char *line = NULL;
+        size_t size = 0;
+        ssize_t len;
+        lines = NULL;
+        count = 0;
+        while ((len = getline(&line, &size, f)) != -1) {
+            if (len && line[len - 1] == '\n')
+                line[--len] = 0;
+            if (!len)
+                continue;
+            if (count == cap) {
+                cap = cap ? cap * 2 : 1024;
+                lines = realloc(lines, cap * sizeof(char *));
+            }
+            lines[count++] = strdup(line);
+        }
+        free(line);
+        fclose(f);
+        if (!count) {
+            fprintf(stderr, "%s: no command lines\n", argv[1]);
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < count; ++i)
+        bytes += strlen(lines[i]);
+
+    struct command_t command;
+    long passes = 0, errors = 0;
+    double start = seconds(), elapsed;
+    do {
+        for (size_t i = 0; i < count; ++i) {
+            memset(&command, 0, sizeof(command));
+            errors += parse_command(lines[i], &command) != 0;
+            free_command(&command);
+        }
+        passes++;
+    } while ((elapsed = seconds() - start) < duration);
+
+    double parsed = (double)passes * count;
+    printf("%zu lines, %ld passes: %.0f lines/s, %.1f ns/line, %.1f MiB/s, %ld syntax errors\n", count,
+           passes, parsed / elapsed, elapsed * 1e9 / parsed, passes * bytes / elapsed / (1 << 20),
+           errors / passes);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Pushes a stream of GiB gigabytes through a 4-stage pipeline run by
+# shellfyre, and by /bin/sh for reference, and prints the throughput.
+#
+#     bench/pipeline.sh [GiB] [shellfyre binary]
+
+gib=${1:-4}
+shellfyre=${2:-./shellfyre}
+bytes=$((gib * 1024 * 1024 * 1024))
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+echo "head -c $bytes /dev/zero | tr a b | cat | wc -c" > "$script"
+
+now() {
+    date +%s.%N
+}
+
+run() {
+    start=$(now)
+    out=$("$1" "$script")
+    end=$(now)
+    if [ "$out" != "$bytes" ]; then
+        echo "$1: expected $bytes bytes, got '$out'" >&2
+        exit 1
+    fi
+    echo "$1 $start $end $gib" | awk '{ printf "%-16s %6.2f s %8.1f MiB/s\n", $1, $3 - $2, $4 * 1024 / ($3 - $2) }'
+}
+
+echo "$gib GiB through head | tr | cat | wc"
+run "$shellfyre"
+run /bin/sh
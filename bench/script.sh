@@ -0,0 +1,36 @@
+#!/bin/sh
+# Runs a script of LINES builtin commands through shellfyre, once given
+# as a file and once on a pipe, and through /bin/sh for reference, and
+# prints commands per second.
+#
+#     bench/script.sh [lines] [shellfyre binary]
+
+lines=${1:-100000}
+shellfyre=${2:-./shellfyre}
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+awk -v n="$lines" 'BEGIN { for (i = 1; i < n; ++i) print "true -v step " i; print "echo done" }' > "$script"
+
+now() {
+    date +%s.%N
+}
+
+report() {
+    if [ "$4" != "done" ]; then
+        echo "$1: the script did not run to the end" >&2
+        exit 1
+    fi
+    echo "$1 $2 $3 $lines" | awk '{ printf "%-24s %6.2f s %10.0f commands/s\n", $1, $3 - $2, $4 / ($3 - $2) }'
+}
+
+echo "$lines lines"
+start=$(now)
+out=$("$shellfyre" "$script")
+report shellfyre-file "$start" "$(now)" "$out"
+start=$(now)
+out=$("$shellfyre" < "$script" | cat)
+report shellfyre-pipe "$start" "$(now)" "$out"
+start=$(now)
+out=$(/bin/sh "$script")
+report sh "$start" "$(now)" "$out"
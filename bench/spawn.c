@@ -0,0 +1,87 @@
+/*
+ * Compares the two ways of launching a command: fork() followed by execv
+ * in the child, which shellfyre used to do, and posix_spawn, which it
+ * does now. Each launch runs /bin/true and is waited for. The heap is
+ * grown and touched between rounds, since copying its page tables is
+ * what makes fork() slow in a long session.
+ *
+ *     gcc -O2 bench/spawn.c -o spawnbench
+ *     ./spawnbench [launches] [max heap MiB]
+ */
+#define _GNU_SOURCE
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static double seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * Launches /bin/true count times, one after the other.
+ * @param  spawn whether to use posix_spawn instead of fork()
+ * @return       microseconds per launch, -1 on error
+ */
+static double launch(int count, int spawn)
+{
+    char *argv[] = {"true", NULL};
+    double start = seconds();
+    for (int i = 0; i < count; ++i) {
+        pid_t pid;
+        if (spawn) {
+            if (posix_spawn(&pid, "/bin/true", NULL, NULL, argv, environ) != 0)
+                return -1;
+        } else {
+            pid = fork();
+            if (pid == -1)
+                return -1;
+            if (pid == 0) {
+                execv("/bin/true", argv);
+                _exit(127);
+            }
+        }
+        int status;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return -1;
+    }
+    return (seconds() - start) * 1e6 / count;
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000;
+    long max_mib = argc > 2 ? atol(argv[2]) : 1024;
+    if (count < 1)
+        count = 1000;
+
+    printf("%d launches of /bin/true\n%9s %14s %14s\n", count, "heap", "fork+exec", "posix_spawn");
+    long grown = 0;
+    for (long mib = 0; mib <= max_mib; mib = mib ? mib * 4 : 16) {
+        // Kept for the rest of the run, like a shell's history and caches
+        if (mib > grown) {
+            char *heap = malloc((mib - grown) << 20);
+            if (!heap) {
+                perror("malloc");
+                return 1;
+            }
+            memset(heap, 1, (mib - grown) << 20);
+            grown = mib;
+        }
+        double forked = launch(count, 0), spawned = launch(count, 1);
+        if (forked < 0 || spawned < 0) {
+            perror("launch");
+            return 1;
+        }
+        printf("%5ld MiB %11.1f us %11.1f us\n", mib, forked, spawned);
+    }
+    return 0;
+}
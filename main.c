@@ -3,6 +3,8 @@
  * Oya Suran 69337
  */
 
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdio.h>
@@ -14,6 +16,30 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "my_module.h"
+
+extern char **environ;
 
 
 const char *sysname = "shellfyre";
@@ -29,13 +55,80 @@ struct command_t
 {
     char *name;
     bool background;
-    bool auto_complete;
     int arg_count;
-    char **args;
-    char *redirects[3];     // in/out redirection
+    char **args;            // argv + 1
+    char **argv;            // name, args..., NULL, ready for exec
+    char *redirects[4];     // <, >, >> and 2> redirection
     struct command_t *next; // for piping
 };
 
+/*
+ * Bump allocator holding everything a parsed command points to: the
+ * command_t of every pipeline stage, their argv arrays and a copy of the
+ * input line the tokens point into. It is reset in one step once the
+ * command is done instead of freeing the pieces one by one.
+ */
+#define ARENA_CHUNK (16 * 1024)
+
+struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size, used;
+    max_align_t data[];
+};
+
+struct arena
+{
+    struct arena_chunk *head;
+    size_t total; // bytes handed out since the last reset
+};
+
+static struct arena command_arena;
+
+/**
+ * Returns zeroed, suitably aligned memory from the arena.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+    size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    struct arena_chunk *c = a->head;
+    if (!c || c->size - c->used < size) {
+        size_t chunk_size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        c = malloc(sizeof(struct arena_chunk) + chunk_size);
+        c->next = a->head;
+        c->size = chunk_size;
+        c->used = 0;
+        a->head = c;
+    }
+    void *p = (char *)c->data + c->used;
+    c->used += size;
+    a->total += size;
+    return memset(p, 0, size);
+}
+
+/**
+ * Forgets everything allocated from the arena. If the last command
+ * needed more than one chunk they are merged into a single bigger one,
+ * so that steady state is one chunk and no malloc at all.
+ */
+void arena_reset(struct arena *a)
+{
+    if (a->head && a->head->next) {
+        size_t size = a->total > ARENA_CHUNK ? a->total : ARENA_CHUNK;
+        while (a->head) {
+            struct arena_chunk *next = a->head->next;
+            free(a->head);
+            a->head = next;
+        }
+        a->head = malloc(sizeof(struct arena_chunk) + size);
+        a->head->next = NULL;
+        a->head->size = size;
+    }
+    if (a->head)
+        a->head->used = 0;
+    a->total = 0;
+}
+
 /**
  * Prints a command struct
  * @param struct command_t *
@@ -45,9 +138,8 @@ void print_command(struct command_t *command)
     int i = 0;
     printf("Command: <%s>\n", command->name);
     printf("\tIs Background: %s\n", command->background ? "yes" : "no");
-    printf("\tNeeds Auto-complete: %s\n", command->auto_complete ? "yes" : "no");
     printf("\tRedirects:\n");
-    for (i = 0; i < 3; i++)
+    for (i = 0; i < 4; i++)
         printf("\t\t%d: %s\n", i, command->redirects[i] ? command->redirects[i] : "N/A");
     printf("\tArguments (%d):\n", command->arg_count);
     for (i = 0; i < command->arg_count; ++i)
@@ -60,715 +152,5952 @@ void print_command(struct command_t *command)
 }
 
 /**
- * Release allocated memory of a command
+ * Release allocated memory of a command. Everything lives in the
+ * command arena, so this releases all pipeline stages at once.
  * @param  command [description]
  * @return         [description]
  */
 int free_command(struct command_t *command)
 {
-    if (command->arg_count)
-    {
-        for (int i = 0; i < command->arg_count; ++i)
-            free(command->args[i]);
-        free(command->args);
-    }
-    for (int i = 0; i < 3; ++i)
-        if (command->redirects[i])
-            free(command->redirects[i]);
-    if (command->next)
-    {
-        free_command(command->next);
-        command->next = NULL;
-    }
-    free(command->name);
-    free(command);
+    (void)command;
+    arena_reset(&command_arena);
     return 0;
 }
 
+/*
+ * Prompt rendering. The user and host name never change and the working
+ * directory only changes through the directory changing builtins, so the
+ * prompt is formatted once and reused until prompt_cwd_changed() or a new
+ * exit status marks it dirty. The optional segments are picked with
+ * SHELLFYRE_PROMPT_SEGMENTS, a comma separated list of "git" and "status".
+ * The git branch is looked up by a worker thread; the prompt is drawn
+ * without it and the line editor redraws once the worker pokes notify[].
+ */
+#define PROMPT_SEGMENT_GIT 1
+#define PROMPT_SEGMENT_STATUS 2
+
+int last_status = 0; // exit status of the last foreground command
+
+static struct
+{
+    bool initialized;
+    unsigned segments;
+    char user[256];
+    char host[256];
+    bool cwd_valid;
+    char cwd[PATH_MAX];
+    bool git_stale; // the branch is for another directory
+    bool dirty;
+    int shown_status;
+    char text[2048];
+    int len;
+
+    // git branch worker, the fields below are protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned requested, answered; // cwd generations
+    char request[PATH_MAX];
+    char branch[128];
+    int notify[2];
+} prompt_cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .notify = {-1, -1}};
+
 /**
- * Show the command prompt
- * @return [description]
+ * Reads at most size - 1 bytes of a small file.
+ * @return bytes read, -1 on failure
  */
-int show_prompt()
+static int read_small_file(const char *path, char *buf, size_t size)
 {
-    char cwd[1024], hostname[1024];
-    gethostname(hostname, sizeof(hostname));
-    getcwd(cwd, sizeof(cwd));
-    printf("%s@%s:%s %s$ ", getenv("USER"), hostname, cwd, sysname);
-    return 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = 0;
+    return n;
 }
 
 /**
- * Parse a command string into a command struct
- * @param  buf     [description]
- * @param  command [description]
- * @return         0
+ * Finds the checked out branch of the repository containing dir by
+ * reading .git/HEAD, or the .git file of a worktree, on the way up.
+ * @param  branch filled with the branch or a short commit id, or emptied
  */
-int parse_command(char *buf, struct command_t *command)
+static void git_branch(const char *dir, char *branch, size_t size)
 {
-    const char *splitters = " \t"; // split at whitespace
-    int index, len;
-    len = strlen(buf);
-    while (len > 0 && strchr(splitters, buf[0]) != NULL) // trim left whitespace
-    {
-        buf++;
-        len--;
-    }
-    while (len > 0 && strchr(splitters, buf[len - 1]) != NULL)
-        buf[--len] = 0; // trim right whitespace
+    char path[PATH_MAX], head[PATH_MAX + 64];
+    size_t len = strlen(dir);
+    branch[0] = 0;
+    if (len >= sizeof(path) - 16)
+        return;
+    memcpy(path, dir, len + 1);
 
-    if (len > 0 && buf[len - 1] == '?') // auto-complete
-        command->auto_complete = true;
-    if (len > 0 && buf[len - 1] == '&') // background
-        command->background = true;
-
-    char *pch = strtok(buf, splitters);
-    command->name = (char *)malloc(strlen(pch) + 1);
-    if (pch == NULL)
-        command->name[0] = 0;
-    else
-        strcpy(command->name, pch);
+    while (1) {
+        char *end = path + (len == 1 ? 0 : len);
+        strcpy(end, "/.git/HEAD");
+        int n = read_small_file(path, head, sizeof(head));
+        if (n == -1) {
+            // A worktree or submodule has a .git file naming the real one
+            strcpy(end, "/.git");
+            n = read_small_file(path, head, sizeof(head) - 8);
+            if (n > 8 && strncmp(head, "gitdir: ", 8) == 0) {
+                head[strcspn(head, "\n")] = 0;
+                char gitdir[PATH_MAX + 64];
+                if (head[8] == '/')
+                    snprintf(gitdir, sizeof(gitdir), "%s/HEAD", head + 8);
+                else
+                    snprintf(gitdir, sizeof(gitdir), "%.*s/%s/HEAD", (int)(end - path), path, head + 8);
+                n = read_small_file(gitdir, head, sizeof(head));
+            } else {
+                n = -1;
+            }
+        }
+        if (n > 0) {
+            head[strcspn(head, "\n")] = 0;
+            if (strncmp(head, "ref: refs/heads/", 16) == 0)
+                snprintf(branch, size, "%.*s", (int)size - 1, head + 16);
+            else // detached
+                snprintf(branch, size, "%.7s", head);
+            return;
+        }
+        if (len <= 1)
+            return;
+        while (len > 1 && path[len - 1] != '/')
+            len--;
+        if (len > 1)
+            len--; // drop the slash too, unless it is the root
+        path[len] = 0;
+    }
+}
 
-    command->args = (char **)malloc(sizeof(char *));
+static void *prompt_git_worker(void *arg)
+{
+    (void)arg;
+    char dir[PATH_MAX], branch[128];
+    sigset_t all; // signals are for the main thread
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    pthread_mutex_lock(&prompt_cache.lock);
+    while (1) {
+        while (prompt_cache.answered == prompt_cache.requested)
+            pthread_cond_wait(&prompt_cache.cond, &prompt_cache.lock);
+        unsigned generation = prompt_cache.requested;
+        strcpy(dir, prompt_cache.request);
+        pthread_mutex_unlock(&prompt_cache.lock);
 
-    int redirect_index;
-    int arg_index = 0;
-    char temp_buf[1024], *arg;
+        git_branch(dir, branch, sizeof(branch));
 
-    while (1)
-    {
-        // tokenize input on splitters
-        pch = strtok(NULL, splitters);
-        if (!pch)
-            break;
-        arg = temp_buf;
-        strcpy(arg, pch);
-        len = strlen(arg);
-
-        if (len == 0)
-            continue;                                        // empty arg, go for next
-        while (len > 0 && strchr(splitters, arg[0]) != NULL) // trim left whitespace
-        {
-            arg++;
-            len--;
-        }
-        while (len > 0 && strchr(splitters, arg[len - 1]) != NULL)
-            arg[--len] = 0; // trim right whitespace
-        if (len == 0)
-            continue; // empty arg, go for next
-
-        // piping to another command
-        if (strcmp(arg, "|") == 0)
-        {
-            struct command_t *c = malloc(sizeof(struct command_t));
-            int l = strlen(pch);
-            pch[l] = splitters[0]; // restore strtok termination
-            index = 1;
-            while (pch[index] == ' ' || pch[index] == '\t')
-                index++; // skip whitespaces
-
-            parse_command(pch + index, c);
-            pch[l] = 0; // put back strtok termination
-            command->next = c;
+        pthread_mutex_lock(&prompt_cache.lock);
+        // A newer request makes this answer useless, go again
+        if (generation != prompt_cache.requested)
             continue;
+        strcpy(prompt_cache.branch, branch);
+        prompt_cache.answered = generation;
+        if (write(prompt_cache.notify[1], "", 1) == -1) {
+            // the pipe is full, a redraw is pending anyway
         }
+    }
+    return NULL;
+}
+
+static void prompt_init()
+{
+    prompt_cache.initialized = true;
+    prompt_cache.git_stale = true;
+    prompt_cache.dirty = true;
 
-        // background process
-        if (strcmp(arg, "&") == 0)
-            continue; // handled before
+    const char *user = getenv("USER");
+    snprintf(prompt_cache.user, sizeof(prompt_cache.user), "%s", user ? user : "");
+    if (gethostname(prompt_cache.host, sizeof(prompt_cache.host)) == -1)
+        strcpy(prompt_cache.host, "localhost");
+    prompt_cache.host[sizeof(prompt_cache.host) - 1] = 0;
 
-        // handle input redirection
-        redirect_index = -1;
-        if (arg[0] == '<')
-            redirect_index = 0;
-        if (arg[0] == '>')
-        {
-            if (len > 1 && arg[1] == '>')
-            {
-                redirect_index = 2;
-                arg++;
-                len--;
-            }
-            else
-                redirect_index = 1;
-        }
-        if (redirect_index != -1)
-        {
-            command->redirects[redirect_index] = malloc(len);
-            strcpy(command->redirects[redirect_index], arg + 1);
-            continue;
-        }
+    const char *segments = getenv("SHELLFYRE_PROMPT_SEGMENTS");
+    char list[256];
+    snprintf(list, sizeof(list), "%s", segments ? segments : "");
+    for (char *s = strtok(list, ", "); s; s = strtok(NULL, ", ")) {
+        if (strcmp(s, "git") == 0)
+            prompt_cache.segments |= PROMPT_SEGMENT_GIT;
+        else if (strcmp(s, "status") == 0)
+            prompt_cache.segments |= PROMPT_SEGMENT_STATUS;
+    }
 
-        // normal arguments
-        if (len > 2 && ((arg[0] == '"' && arg[len - 1] == '"') || (arg[0] == '\'' && arg[len - 1] == '\''))) // quote wrapped arg
-        {
-            arg[--len] = 0;
-            arg++;
+    if (prompt_cache.segments & PROMPT_SEGMENT_GIT) {
+        pthread_t thread;
+        if (pipe2(prompt_cache.notify, O_NONBLOCK | O_CLOEXEC) == -1
+            || pthread_create(&thread, NULL, prompt_git_worker, NULL) != 0) {
+            prompt_cache.segments &= ~PROMPT_SEGMENT_GIT;
+            return;
         }
-        command->args = (char **)realloc(command->args, sizeof(char *) * (arg_index + 1));
-        command->args[arg_index] = (char *)malloc(len + 1);
-        strcpy(command->args[arg_index++], arg);
+        pthread_detach(thread);
     }
-    command->arg_count = arg_index;
-    return 0;
 }
 
-void prompt_backspace()
+/**
+ * Marks the cached working directory stale. Called by every builtin
+ * that changes directory.
+ */
+void prompt_cwd_changed()
 {
-    putchar(8);   // go back 1
-    putchar(' '); // write empty over
-    putchar(8);   // go back 1 again
+    prompt_cache.cwd_valid = false;
+    prompt_cache.git_stale = true;
+    prompt_cache.dirty = true;
 }
 
 /**
- * Prompt a command from the user
- * @param  buf      [description]
- * @param  buf_size [description]
- * @return          [description]
+ * The working directory, from the cache unless it was marked stale.
  */
-int prompt(struct command_t *command)
+const char *prompt_cwd()
 {
-    int index = 0;
-    char c;
-    char buf[4096];
-    static char oldbuf[4096];
-
-    // tcgetattr gets the parameters of the current terminal
-    // STDIN_FILENO will tell tcgetattr that it should write the settings
-    // of stdin to oldt
-    static struct termios backup_termios, new_termios;
-    tcgetattr(STDIN_FILENO, &backup_termios);
-    new_termios = backup_termios;
-    // ICANON normally takes care that one line at a time will be processed
-    // that means it will return if it sees a "\n" or an EOF or an EOL
-    new_termios.c_lflag &= ~(ICANON | ECHO); // Also disable automatic echo. We manually echo each char.
-    // Those new settings will be set to STDIN
-    // TCSANOW tells tcsetattr to change attributes immediately.
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
+    if (!prompt_cache.cwd_valid) {
+        if (!getcwd(prompt_cache.cwd, sizeof(prompt_cache.cwd)))
+            strcpy(prompt_cache.cwd, "?");
+        prompt_cache.cwd_valid = true;
+    }
+    return prompt_cache.cwd;
+}
 
-    // FIXME: backspace is applied before printing chars
-    show_prompt();
-    int multicode_state = 0;
-    buf[0] = 0;
+/**
+ * Descriptor that becomes readable when an asynchronous prompt segment
+ * has changed, -1 when there are none.
+ */
+int prompt_notify_fd()
+{
+    return prompt_cache.notify[0];
+}
 
-    while (1)
-    {
-        c = getchar();
-        // printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
+/**
+ * Render the command prompt. Only does system calls after a directory
+ * change, otherwise the cached prompt is copied out.
+ * @param  out  buffer the prompt is written to
+ * @param  size size of out
+ * @return      length of the prompt
+ */
+int render_prompt(char *out, size_t size)
+{
+    if (!prompt_cache.initialized)
+        prompt_init();
 
-        if (c == 9) // handle tab
-        {
-            buf[index++] = '?'; // autocomplete
-            break;
+    prompt_cwd();
+    if (prompt_cache.git_stale) {
+        prompt_cache.git_stale = false;
+        if (prompt_cache.segments & PROMPT_SEGMENT_GIT) {
+            pthread_mutex_lock(&prompt_cache.lock);
+            strcpy(prompt_cache.request, prompt_cache.cwd);
+            prompt_cache.requested++;
+            pthread_cond_signal(&prompt_cache.cond);
+            pthread_mutex_unlock(&prompt_cache.lock);
         }
+    }
 
-        if (c == 127) // handle backspace
-        {
-            if (index > 0)
-            {
-                prompt_backspace();
-                index--;
-            }
-            continue;
-        }
-        if (c == 27 && multicode_state == 0) // handle multi-code keys
-        {
-            multicode_state = 1;
-            continue;
-        }
-        if (c == 91 && multicode_state == 1)
-        {
-            multicode_state = 2;
-            continue;
-        }
-        if (c == 65 && multicode_state == 2) // up arrow
-        {
-            int i;
-            while (index > 0)
-            {
-                prompt_backspace();
-                index--;
-            }
-            for (i = 0; oldbuf[i]; ++i)
-            {
-                putchar(oldbuf[i]);
-                buf[i] = oldbuf[i];
-            }
-            index = i;
-            continue;
-        }
-        else
-            multicode_state = 0;
+    if ((prompt_cache.segments & PROMPT_SEGMENT_STATUS) && prompt_cache.shown_status != last_status)
+        prompt_cache.dirty = true;
 
-        putchar(c); // echo the character
-        buf[index++] = c;
-        if (index >= sizeof(buf) - 1)
-            break;
-        if (c == '\n') // enter key
-            break;
-        if (c == 4) // Ctrl+D
-            return EXIT;
+    if (prompt_cache.segments & PROMPT_SEGMENT_GIT) {
+        char drain[64];
+        while (read(prompt_cache.notify[0], drain, sizeof(drain)) > 0)
+            prompt_cache.dirty = true;
     }
-    if (index > 0 && buf[index - 1] == '\n') // trim newline from the end
-        index--;
-    buf[index++] = 0; // null terminate string
-
-    strcpy(oldbuf, buf);
 
-    parse_command(buf, command);
+    if (prompt_cache.dirty) {
+        char git[160] = "", status[32] = "";
+        if (prompt_cache.segments & PROMPT_SEGMENT_GIT) {
+            pthread_mutex_lock(&prompt_cache.lock);
+            // Never show the branch of the previous directory
+            if (prompt_cache.answered == prompt_cache.requested && prompt_cache.branch[0])
+                snprintf(git, sizeof(git), " (%s)", prompt_cache.branch);
+            pthread_mutex_unlock(&prompt_cache.lock);
+        }
+        if ((prompt_cache.segments & PROMPT_SEGMENT_STATUS) && last_status != 0)
+            snprintf(status, sizeof(status), " [%d]", last_status);
+        prompt_cache.shown_status = last_status;
 
-    // print_command(command); // DEBUG: uncomment for debugging
+        int len = snprintf(prompt_cache.text, sizeof(prompt_cache.text), "%s@%s:%s%s%s %s$ ",
+                           prompt_cache.user, prompt_cache.host, prompt_cache.cwd, git, status, sysname);
+        prompt_cache.len = len < (int)sizeof(prompt_cache.text) ? len : (int)sizeof(prompt_cache.text) - 1;
+        prompt_cache.dirty = false;
+    }
 
-    // restore the old settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
-    return SUCCESS;
+    int len = prompt_cache.len < (int)size ? prompt_cache.len : (int)size - 1;
+    memcpy(out, prompt_cache.text, len);
+    out[len] = 0;
+    return len;
 }
 
-int process_command(struct command_t *command);
-int isBackground(struct command_t *command);
-int filesearch_helper(char *directory_name, char* substr, bool o_flag, bool r_flag);
+/*
+ * Job control. Every pipeline becomes a job whose stages share a process
+ * group. The foreground job owns the terminal while the shell waits on
+ * its own pids; background jobs are reaped as they finish. The SIGCHLD
+ * handler only writes to a self-pipe, the actual waitpid(WNOHANG) loop
+ * runs in jobs_reap(), called from the line editor's poll loop and
+ * between script lines, so it can never steal a foreground child.
+ */
+enum job_state
+{
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE,
+};
 
-int isBackground(struct command_t *command) {
-    for (int i = command->arg_count; i > 0; --i) {
+struct job_process
+{
+    pid_t pid;
+    enum job_state state;
+    int status;
+};
 
-        printf("%s \n", command->args[i]);
-//        if (strcmp(command->args[i], "&") == 0) {
-//            return 1;
-//        }
+struct job
+{
+    int id;
+    pid_t pgid;       // 0 without job control, children stay in the shell's group
+    enum job_state state;
+    bool notify;      // changed state in the background, not yet reported
+    bool last_failed; // the last stage could not be started
+    char *text;
+    struct job *next;
+    int count;
+    struct job_process procs[];
+};
+
+static struct
+{
+    bool control; // interactive: process groups and terminal handover
+    pid_t shell_pgid;
+    struct termios tmodes; // the shell's own terminal modes
+    int pipe[2];
+    struct job *list; // ordered by id
+    int current, previous;
+    volatile sig_atomic_t interrupted;
+} jobs = {.pipe = {-1, -1}};
+
+static void job_sigchld(int sig)
+{
+    (void)sig;
+    int saved = errno;
+    if (write(jobs.pipe[1], "", 1) == -1) {
+        // the pipe is full, jobs_reap() is due anyway
     }
-    return 0;
+    errno = saved;
 }
 
-/*
- * Helper function to search for files recursively
- */
-int filesearch_helper(char *directory_name, char *substr, bool o_flag, bool r_flag){
+static void job_sigint(int sig)
+{
+    (void)sig;
+    jobs.interrupted = 1;
+}
 
-    DIR *d;
-    // Open the given directory
-    struct dirent *dir;
-    d = opendir(directory_name);
-    printf("D value when opening %s is %d \n", directory_name, d);
+/**
+ * Sets up SIGCHLD notification and, for an interactive shell, puts the
+ * shell in its own process group in the foreground of the terminal.
+ * @param interactive whether to enable job control
+ */
+void jobs_init(bool interactive)
+{
+    if (pipe2(jobs.pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+        jobs.pipe[0] = jobs.pipe[1] = -1;
 
-    if (d)
-    {
-        printf("====== OPENED: %s ========\n", directory_name);
-
-        // Start reading the contents of the directory
-        while ((dir = readdir(d)) != NULL)
-        {
-            char *ptr = strstr(dir->d_name, substr);
-
-            if (ptr != NULL) // A match
-            {
-                printf("'%s' contains '%s'\n", dir->d_name, substr);
-
-                if (o_flag)
-                {
-                    char sys_command[50];
-                    strcpy(sys_command, "xdg-open ");
-                    strcat(sys_command, ptr);
-                    system(sys_command);
-                }
+    struct sigaction sa = {0};
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = job_sigchld;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
 
-            }
+    if (!interactive)
+        return;
 
-            // If it is a directory, make a recursive call in there
-            if (dir->d_type == DT_DIR && r_flag && (strcmp(dir->d_name, ".") != 0) && (strcmp(dir->d_name, "..") != 0)) {
-                filesearch_helper(dir->d_name, substr, o_flag, r_flag);
-            }
+    // Wait until we are in the foreground if started in the background
+    while (tcgetpgrp(STDIN_FILENO) != (jobs.shell_pgid = getpgrp()))
+        kill(-jobs.shell_pgid, SIGTTIN);
 
+    // The keys that signal a job reach it, not the shell. SIGINT gets a
+    // handler rather than being ignored so that it can interrupt wait.
+    sa.sa_handler = job_sigint;
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
 
-        }
-        closedir(d);
-        printf("====== CLOSED: %s ========\n", directory_name);
+    jobs.shell_pgid = getpid();
+    if (setpgid(0, 0) == -1 && errno != EPERM) // EPERM: already a session leader
+        return;
+    jobs.shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, jobs.shell_pgid);
+    tcgetattr(STDIN_FILENO, &jobs.tmodes);
+    jobs.control = true;
+}
 
-    }
+/**
+ * Descriptor that becomes readable when a child changed state.
+ */
+int job_notify_fd()
+{
+    return jobs.pipe[0];
+}
 
+static int job_exit_status(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return 128 + WTERMSIG(status);
 }
 
-// ref: https://www.geeksforgeeks.org/implement-your-own-tail-read-last-n-lines-of-a-huge-file/
-/*
- * Prints the last n (maximum 10) directories in the history of the user.
+/**
+ * Exit status of a job, that of its last stage.
  */
-void print_history(FILE* in, int n)
+static int job_status(const struct job *job)
 {
-    int count = 0;
-    long pos;
-    char str[300];
+    if (job->last_failed)
+        return 127;
+    const struct job_process *last = &job->procs[job->count - 1];
+    return last->state == JOB_DONE ? job_exit_status(last->status) : 128 + SIGTSTP;
+}
 
-    // Reach the end of the file
-    if (fseek(in, 0, SEEK_END)) {
-        perror("fseek() failed");
+static void job_update_state(struct job *job)
+{
+    bool running = false, stopped = false;
+    for (int i = 0; i < job->count; ++i) {
+        running |= job->procs[i].state == JOB_RUNNING;
+        stopped |= job->procs[i].state == JOB_STOPPED;
     }
-    else
-    {
-        pos = ftell(in);
-        // Climb up n lines
-        while (pos)
-        {
-            if (!fseek(in, --pos, SEEK_SET))
-            {
-                if (fgetc(in) == '\n')
-                    if (count++ == n)
-                        break;
-            }
-            else
-                perror("fseek() failed");
-        }
+    enum job_state state = running ? JOB_RUNNING : stopped ? JOB_STOPPED : JOB_DONE;
+    if (state != job->state && state != JOB_RUNNING)
+        job->notify = true;
+    job->state = state;
+}
 
-        printf("Printing last %d lines -\n", n);
-        char letter = 97 + n-1;
-        int num = n;
-        while (fgets(str, sizeof(str), in)) {
-            printf("%c %d) %s", letter, num, str);
-            letter--;
-            num--;
+/**
+ * Records a status returned by waitpid.
+ * @return the job the process belongs to, NULL if it is not ours
+ */
+static struct job *job_record(struct job *job, pid_t pid, int status)
+{
+    for (struct job *j = job ? job : jobs.list; j; j = job ? NULL : j->next) {
+        for (int i = 0; i < j->count; ++i) {
+            if (j->procs[i].pid != pid)
+                continue;
+            j->procs[i].status = status;
+            j->procs[i].state = WIFSTOPPED(status) ? JOB_STOPPED : WIFCONTINUED(status) ? JOB_RUNNING : JOB_DONE;
+            job_update_state(j);
+            return j;
         }
+    }
+    return NULL;
+}
 
-        char c;
-        printf("\n Enter something:");
-        printf("\n Assuming you entered 2....\n");
-
+static void job_add(struct job *job)
+{
+    struct job **p = &jobs.list;
+    int id = 1;
+    for (; *p; p = &(*p)->next)
+        id = (*p)->id + 1;
+    job->id = id;
+    *p = job;
+}
 
-        // Again, finding the corresponding lines by climbing
-        // the necessary amount upwards.
-        count = 0;
-        if (fseek(in, 0, SEEK_END))
-            perror("fseek() failed");
-        else {
-            pos = ftell(in);
-            while (pos) {
-                if (!fseek(in, --pos, SEEK_SET)) {
-                    if (fgetc(in) == '\n')
-                        if (count++ == 2)
-                            break;
-                } else
-                    perror("fseek() failed");
-            }
-            fgets(str, sizeof(str), in);
-            str[strlen(str)-1]='\0';
+static void job_make_current(struct job *job)
+{
+    if (jobs.current != job->id) {
+        jobs.previous = jobs.current;
+        jobs.current = job->id;
+    }
+}
 
-            // Change into desired directory
-            if (chdir(str) != 0){
-                printf ("chdir failed - %s\n", strerror (errno));
-            }
+static void job_free(struct job *job)
+{
+    free(job->text);
+    free(job);
+}
 
+static void job_remove(struct job *job)
+{
+    for (struct job **p = &jobs.list; *p; p = &(*p)->next) {
+        if (*p == job) {
+            *p = job->next;
+            break;
         }
     }
-    printf("\n\n");
+    if (jobs.current == job->id) {
+        jobs.current = jobs.previous;
+        jobs.previous = 0;
+    } else if (jobs.previous == job->id) {
+        jobs.previous = 0;
+    }
+    job_free(job);
 }
 
-int my_min(int first, int second) {
-    return ((first > second) ? second : first);
-}
+void filesearch_open_reaped(pid_t pid, int status);
 
-int loaded = 0;
-int main()
+/**
+ * Collects every child that changed state since the last call, without
+ * blocking. Cheap when nothing happened: one read of the self-pipe.
+ */
+void jobs_reap()
 {
-    while (1)
-    {
-        struct command_t *command = malloc(sizeof(struct command_t));
-        memset(command, 0, sizeof(struct command_t)); // set all bytes to 0
-
-        int code;
-        code = prompt(command);
-        if (code == EXIT)
-            break;
+    char drain[256];
+    ssize_t n, total = 0;
+    while ((n = read(jobs.pipe[0], drain, sizeof(drain))) > 0)
+        total += n;
+    if (total == 0 && jobs.pipe[0] != -1)
+        return;
 
-        code = process_command(command);
-        if (code == EXIT)
-            break;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+        if (!job_record(NULL, pid, status))
+            filesearch_open_reaped(pid, status);
 
-        free_command(command);
+    // Nobody is told about finished jobs without job control
+    if (!jobs.control) {
+        for (struct job *j = jobs.list, *next; j; j = next) {
+            next = j->next;
+            if (j->state == JOB_DONE)
+                job_remove(j);
+        }
     }
+}
 
-    printf("\n");
-    return 0;
+static void job_print(const struct job *job, bool pids)
+{
+    char state[32];
+    if (job->state == JOB_RUNNING)
+        strcpy(state, "Running");
+    else if (job->state == JOB_STOPPED)
+        strcpy(state, "Stopped");
+    else if (job_status(job) == 0)
+        strcpy(state, "Done");
+    else
+        snprintf(state, sizeof(state), "Exit %d", job_status(job));
+
+    char mark = job->id == jobs.current ? '+' : job->id == jobs.previous ? '-' : ' ';
+    if (pids)
+        printf("[%d]%c %d %-22s %s\n", job->id, mark, job->procs[0].pid, state, job->text);
+    else
+        printf("[%d]%c  %-22s %s\n", job->id, mark, state, job->text);
 }
 
-int process_command(struct command_t *command) {
-    int r;
-    if (strcmp(command->name, "") == 0)
-        return SUCCESS;
+/**
+ * Whether a background job stopped or finished since the last report.
+ */
+bool jobs_changed()
+{
+    for (struct job *j = jobs.list; j; j = j->next)
+        if (j->notify)
+            return true;
+    return false;
+}
 
-    if (strcmp(command->name, "exit") == 0){
-        if (loaded)
-        {
-            system("sudo rmmod my_module.ko");
-            printf("Previously installed module has been removed.\n");
-        }
+/**
+ * Reports background jobs that stopped or finished since the last call
+ * and forgets the finished ones.
+ * @return whether anything was printed
+ */
+bool jobs_notify()
+{
+    bool printed = false;
+    for (struct job *j = jobs.list, *next; j; j = next) {
+        next = j->next;
+        if (!j->notify)
+            continue;
+        j->notify = false;
+        job_print(j, false);
+        printed = true;
+        if (j->state == JOB_DONE)
+            job_remove(j);
+    }
+    if (printed)
+        fflush(stdout);
+    return printed;
+}
 
-        return EXIT;
+/**
+ * Creates an empty job for a pipeline, named after its command line.
+ * @param  command head of the command->next chain
+ */
+struct job *job_create(struct command_t *command)
+{
+    int count = 0;
+    size_t len = 1;
+    for (struct command_t *c = command; c; c = c->next) {
+        count++;
+        for (char **a = c->argv; *a; ++a)
+            len += strlen(*a) + 1;
+        len += 2;
     }
 
-    if (strcmp(command->name, "cd") == 0) {
-        if (command->arg_count > 0) {
-            r = chdir(command->args[0]);
-            if (r == -1) {
-                printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-            } else {
-                // Write the directory into the history file.
-                FILE *fp = fopen("/home/cdh_history.txt", "a");
-                char cwd[256];
-                getcwd(cwd, sizeof(cwd));
-                printf("\n%s\n", cwd);
-                strcat(cwd, "\n");
-                fprintf(fp,cwd);
-                fclose(fp);
-            }
-            return SUCCESS;
-        }
+    struct job *job = calloc(1, sizeof(struct job) + sizeof(struct job_process) * count);
+    job->text = malloc(len);
+    char *p = job->text;
+    for (struct command_t *c = command; c; c = c->next) {
+        for (char **a = c->argv; *a; ++a)
+            p += sprintf(p, a == c->argv ? "%s" : " %s", *a);
+        if (c->next)
+            p += sprintf(p, " | ");
     }
+    return job;
+}
 
-    if (strcmp(command->name, "take") == 0) {
-        printf("Creating Directories \n");
+/**
+ * Waits for the processes of a job until all of them exit or one stops.
+ * A foreground job gets the terminal for the duration. The job is freed
+ * once it is done; a stopped one stays in the job table.
+ * @param  job        job to wait for
+ * @param  foreground whether the job was started or resumed in the foreground
+ * @return            exit status of the job
+ */
+int job_wait(struct job *job, bool foreground)
+{
+    bool listed = false;
+    for (struct job *j = jobs.list; j; j = j->next)
+        listed |= j == job;
 
-        // parsing
-        char delim[] = "/";
-        char *ptr = strtok(command->args[0], delim);
-        while (ptr != NULL) {
-            // Create first directory
-            int check = mkdir(ptr, 0777);
+    if (foreground && jobs.control && job->pgid)
+        tcsetpgrp(STDIN_FILENO, job->pgid);
 
-            if (!check) {
-                r = chdir(ptr);
-                if (r == -1) {
-                    printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-                }
-            } else { // This most likely means that the directory already existed.
-                r = chdir(ptr);
-                if (r == -1) {
-                    printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+    jobs.interrupted = 0;
+    bool interrupted = false;
+    for (int i = 0; i < job->count && job->state == JOB_RUNNING; ++i) {
+        while (job->procs[i].state == JOB_RUNNING) {
+            int status;
+            pid_t pid = waitpid(job->procs[i].pid, &status, WUNTRACED);
+            if (pid == -1 && errno == EINTR && !jobs.interrupted)
+                continue;
+            if (pid == -1) {
+                // Interrupted wait builtin, or already collected elsewhere
+                interrupted = errno == EINTR;
+                if (!interrupted) {
+                    job->procs[i].state = JOB_DONE;
+                    job_update_state(job);
                 }
+                break;
             }
-            ptr = strtok(NULL, delim);
+            job_record(job, pid, status);
         }
-        return SUCCESS;
+        if (interrupted)
+            break;
     }
 
-    // Start searching with the proper flags
-    if (strcmp(command->name, "filesearch") == 0) {
-        bool o_flag = false;
-        bool r_flag = false;
-
-        if (command->arg_count == 2) {
-            if (strcmp(command->args[1], "-o") == 0) o_flag = true;
-            if (strcmp(command->args[1], "-r") == 0) r_flag = true;
-        }
+    if (foreground && jobs.control) {
+        tcsetpgrp(STDIN_FILENO, jobs.shell_pgid);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &jobs.tmodes);
+    }
+    if (interrupted) {
+        printf("\n");
+        return 128 + SIGINT;
+    }
 
-        if (command->arg_count == 3) {
-            if (strcmp(command->args[2], "-o") == 0) o_flag = true;
-            if (strcmp(command->args[2], "-r") == 0) r_flag = true;
+    int status = job_status(job);
+    if (job->state == JOB_STOPPED && foreground) {
+        if (!listed)
+            job_add(job);
+        job_make_current(job);
+        job->notify = false;
+        printf("\n");
+        job_print(job, false);
+    } else if (job->state == JOB_DONE) {
+        // The terminal echoed ^C but no newline
+        const struct job_process *last = &job->procs[job->count - 1];
+        if (foreground && WIFSIGNALED(last->status) && WTERMSIG(last->status) == SIGINT)
+            printf("\n");
+        if (listed)
+            job_remove(job);
+        else
+            job_free(job);
+    }
+    return status;
+}
+
+/**
+ * Puts a launched job in the background, or waits for it.
+ * @return exit status of a foreground job, 0 for a background one
+ */
+int job_launch(struct job *job, bool background)
+{
+    if (!background)
+        return job_wait(job, true);
+
+    job_add(job);
+    job_make_current(job);
+    if (jobs.control)
+        printf("[%d] %d\n", job->id, job->procs[job->count - 1].pid);
+    return 0;
+}
+
+/**
+ * Looks up a job from a job spec: %n, %+, %% or %-. A plain number is a
+ * process id when pids is set and a job number otherwise.
+ * @param  spec job spec, NULL for the current job
+ * @param  who  builtin name used in error messages
+ */
+static struct job *job_find(const char *spec, bool pids, const char *who)
+{
+    int id = jobs.current;
+    pid_t pid = 0;
+    if (spec) {
+        if (strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0)
+            id = jobs.current;
+        else if (strcmp(spec, "%-") == 0)
+            id = jobs.previous;
+        else if (spec[0] == '%')
+            id = atoi(spec + 1);
+        else if (pids)
+            pid = atoi(spec);
+        else
+            id = atoi(spec);
+    }
+
+    for (struct job *j = jobs.list; j; j = j->next) {
+        if (!pid && j->id == id)
+            return j;
+        for (int i = 0; pid && i < j->count; ++i)
+            if (j->procs[i].pid == pid)
+                return j;
+    }
+    printf("-%s: %s: %s: no such job\n", sysname, who, spec ? spec : "current");
+    return NULL;
+}
+
+/**
+ * jobs [-l]: lists the job table.
+ */
+int jobs_builtin(struct command_t *command)
+{
+    bool pids = command->arg_count > 0 && strcmp(command->args[0], "-l") == 0;
+    jobs_reap();
+    for (struct job *j = jobs.list, *next; j; j = next) {
+        next = j->next;
+        job_print(j, pids);
+        j->notify = false;
+        if (j->state == JOB_DONE)
+            job_remove(j);
+    }
+    return SUCCESS;
+}
+
+/**
+ * fg [job] / bg [job]: continues a stopped job in the foreground or in
+ * the background.
+ */
+int fg_builtin(struct command_t *command)
+{
+    bool foreground = strcmp(command->name, "fg") == 0;
+    if (!jobs.control) {
+        printf("-%s: %s: no job control\n", sysname, command->name);
+        last_status = 1;
+        return SUCCESS;
+    }
+    jobs_reap();
+    struct job *job = job_find(command->arg_count > 0 ? command->args[0] : NULL, false, command->name);
+    if (!job || job->state == JOB_DONE) {
+        last_status = 1;
+        return SUCCESS;
+    }
+
+    for (int i = 0; i < job->count; ++i)
+        if (job->procs[i].state == JOB_STOPPED)
+            job->procs[i].state = JOB_RUNNING;
+    job->state = JOB_RUNNING;
+    job->notify = false;
+    job_make_current(job);
+
+    if (foreground) {
+        printf("%s\n", job->text);
+        fflush(stdout);
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+        kill(-job->pgid, SIGCONT);
+        last_status = job_wait(job, true);
+    } else {
+        printf("[%d]+ %s &\n", job->id, job->text);
+        kill(-job->pgid, SIGCONT);
+    }
+    return SUCCESS;
+}
+
+/**
+ * wait [job|pid]: waits for one job, or for every running job. Ctrl+C
+ * stops waiting.
+ */
+int wait_builtin(struct command_t *command)
+{
+    jobs_reap();
+    if (command->arg_count > 0) {
+        struct job *job = job_find(command->args[0], true, command->name);
+        if (!job) {
+            last_status = 127;
+            return SUCCESS;
+        }
+        last_status = job_wait(job, false);
+        return SUCCESS;
+    }
+
+    for (struct job *j = jobs.list, *next; j; j = next) {
+        next = j->next;
+        if (j->state != JOB_RUNNING)
+            continue;
+        job_wait(j, false);
+        if (jobs.interrupted) {
+            last_status = 128 + SIGINT;
+            return SUCCESS;
+        }
+    }
+    last_status = 0;
+    return SUCCESS;
+}
+
+/*
+ * Command line lexer. A single pass over the line turns it into words
+ * and operators (| & < > >> 2>). Quotes and backslash escapes are
+ * resolved in place by compacting the word inside the line buffer, so
+ * every word is a slice of the line and nothing is copied.
+ */
+enum token_type
+{
+    TOK_WORD,
+    TOK_PIPE,
+    TOK_AMP,
+    TOK_IN,     // <
+    TOK_OUT,    // >
+    TOK_APPEND, // >>
+    TOK_ERR,    // 2>
+};
+
+struct token
+{
+    enum token_type type;
+    char *text; // words only, not terminated until lexing is over
+    size_t len;
+};
+
+static bool is_word_end(char c)
+{
+    return c == 0 || c == ' ' || c == '\t' || c == '\n' || c == '|' || c == '&' || c == '<' || c == '>';
+}
+
+/**
+ * Splits a line into tokens. Words are NUL-terminated once the whole
+ * line has been read, since a terminator may land on the character
+ * right after the word, which can be the next operator.
+ * @param  line   the line, modified in place
+ * @param  tokens room for strlen(line) + 1 tokens
+ * @return        number of tokens, -1 on an unterminated quote
+ */
+static int lex_line(char *line, struct token *tokens)
+{
+    enum { PLAIN, SINGLE, DOUBLE } state;
+    char *r = line;
+    int n = 0;
+
+    while (1) {
+        while (*r == ' ' || *r == '\t' || *r == '\n')
+            r++;
+        if (*r == 0 || *r == '#') // end of line or comment
+            break;
+
+        struct token *t = &tokens[n++];
+        t->text = NULL;
+        t->len = 0;
+        if (*r == '|' || *r == '&' || *r == '<') {
+            t->type = *r == '|' ? TOK_PIPE : *r == '&' ? TOK_AMP : TOK_IN;
+            r++;
+            continue;
+        }
+        if (*r == '>') {
+            t->type = r[1] == '>' ? TOK_APPEND : TOK_OUT;
+            r += t->type == TOK_APPEND ? 2 : 1;
+            continue;
+        }
+        if (r[0] == '2' && r[1] == '>') {
+            t->type = TOK_ERR;
+            r += 2;
+            continue;
+        }
+
+        t->type = TOK_WORD;
+        t->text = r;
+        char *w = r; // write position, never ahead of r
+        state = PLAIN;
+        while (*r) {
+            if (state == PLAIN) {
+                if (is_word_end(*r))
+                    break;
+                if (*r == '\'' || *r == '"') {
+                    state = *r++ == '\'' ? SINGLE : DOUBLE;
+                    continue;
+                }
+                if (*r == '\\' && r[1])
+                    r++;
+            } else if (state == SINGLE) {
+                if (*r == '\'') {
+                    state = PLAIN;
+                    r++;
+                    continue;
+                }
+            } else {
+                if (*r == '"') {
+                    state = PLAIN;
+                    r++;
+                    continue;
+                }
+                if (*r == '\\' && (r[1] == '"' || r[1] == '\\' || r[1] == '$' || r[1] == '`'))
+                    r++;
+            }
+            *w++ = *r++;
+        }
+        if (state != PLAIN)
+            return -1;
+        t->len = w - t->text;
+    }
+
+    for (int i = 0; i < n; ++i)
+        if (tokens[i].type == TOK_WORD)
+            tokens[i].text[tokens[i].len] = 0;
+    return n;
+}
+
+/**
+ * Parse a command string into a command struct. The line is lexed once
+ * and the pipeline is built from the token stream. The whole result,
+ * including the pipeline chain, is allocated from the command arena and
+ * released by free_command.
+ * @param  buf     [description]
+ * @param  command [description]
+ * @return         0, -1 on a syntax error (command is left empty)
+ */
+int parse_command(char *buf, struct command_t *command)
+{
+    size_t len = strlen(buf);
+    char *line = arena_alloc(&command_arena, len + 1);
+    memcpy(line, buf, len + 1);
+
+    struct token *tokens = arena_alloc(&command_arena, sizeof(struct token) * (strlen(line) + 1));
+    int n = lex_line(line, tokens);
+    const char *error = n < 0 ? "unterminated quote" : NULL;
+
+    struct command_t *stage = command;
+    for (int i = 0; !error;) {
+        // Size argv for the words of this stage: name, args..., NULL
+        int words = 0;
+        for (int j = i; j < n && tokens[j].type != TOK_PIPE; ++j)
+            if (tokens[j].type == TOK_WORD && (j == i || tokens[j - 1].type == TOK_WORD
+                                               || tokens[j - 1].type == TOK_AMP))
+                words++;
+        stage->argv = arena_alloc(&command_arena, sizeof(char *) * (words + 2));
+
+        int argc = 0;
+        for (; i < n && tokens[i].type != TOK_PIPE && !error; ++i) {
+            int redirect_index = -1;
+            switch (tokens[i].type) {
+            case TOK_WORD:
+                stage->argv[argc++] = tokens[i].text;
+                break;
+            case TOK_AMP:
+                if (i != n - 1)
+                    error = "unexpected '&'";
+                command->background = true;
+                break;
+            case TOK_IN:
+                redirect_index = 0;
+                break;
+            case TOK_OUT:
+                redirect_index = 1;
+                break;
+            case TOK_APPEND:
+                redirect_index = 2;
+                break;
+            case TOK_ERR:
+                redirect_index = 3;
+                break;
+            default:
+                break;
+            }
+            if (redirect_index == -1)
+                continue;
+            if (i + 1 >= n || tokens[i + 1].type != TOK_WORD)
+                error = "missing redirection target";
+            else
+                stage->redirects[redirect_index] = tokens[++i].text;
+        }
+
+        stage->name = argc ? stage->argv[0] : "";
+        stage->args = stage->argv + 1;
+        stage->arg_count = argc ? argc - 1 : 0;
+        if (error || i >= n)
+            break;
+
+        // A pipe needs a command on both sides
+        if (argc == 0 || i + 1 >= n) {
+            error = "unexpected '|'";
+            break;
+        }
+        stage->next = arena_alloc(&command_arena, sizeof(struct command_t));
+        stage = stage->next;
+        i++;
+    }
+
+    if (error) {
+        printf("-%s: syntax error: %s\n", sysname, error);
+        memset(command, 0, sizeof(struct command_t));
+        command->name = "";
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Line editor for the interactive prompt. The line and the cursor are
+ * kept in memory and every change is drawn with a single write(): the
+ * prompt and the visible part of the line followed by ANSI sequences to
+ * clear the rest and place the cursor. Lines wider than the terminal
+ * scroll horizontally around the cursor.
+ */
+#define EDIT_BUF 4096
+#define EDIT_PROMPT 2048
+#define EDIT_READ 64
+
+struct line_editor
+{
+    char buf[EDIT_BUF];
+    int len, cursor;
+    char prompt[EDIT_PROMPT];
+    int prompt_len;
+    int cols;
+    char out[EDIT_PROMPT + EDIT_BUF + 64]; // batched terminal output
+    int out_len;
+};
+
+static void le_append(struct line_editor *le, const char *s, int n)
+{
+    if (le->out_len + n > (int)sizeof(le->out))
+        n = sizeof(le->out) - le->out_len;
+    memcpy(le->out + le->out_len, s, n);
+    le->out_len += n;
+}
+
+static void le_flush(struct line_editor *le)
+{
+    for (int done = 0; done < le->out_len;) {
+        ssize_t n = write(STDOUT_FILENO, le->out + done, le->out_len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    le->out_len = 0;
+}
+
+/**
+ * Redraws the prompt and the line in one write.
+ */
+static void le_refresh(struct line_editor *le)
+{
+    const char *b = le->buf;
+    int len = le->len, pos = le->cursor;
+    int plen = le->prompt_len < le->cols ? le->prompt_len : 0;
+
+    // Scroll so that the cursor stays on screen
+    while (plen + pos >= le->cols && pos > 0) {
+        b++;
+        len--;
+        pos--;
+    }
+    while (plen + len > le->cols && len > 0)
+        len--;
+
+    char seq[32];
+    le_append(le, "\r", 1);
+    le_append(le, le->prompt, plen);
+    le_append(le, b, len);
+    le_append(le, "\x1b[0K", 4); // erase the rest of the line
+    int n = snprintf(seq, sizeof(seq), "\r\x1b[%dC", plen + pos);
+    if (plen + pos > 0)
+        le_append(le, seq, n);
+    le_flush(le);
+}
+
+static void le_insert(struct line_editor *le, const char *s, int n)
+{
+    if (le->len + n >= EDIT_BUF)
+        n = EDIT_BUF - 1 - le->len;
+    memmove(le->buf + le->cursor + n, le->buf + le->cursor, le->len - le->cursor);
+    memcpy(le->buf + le->cursor, s, n);
+    le->len += n;
+    le->cursor += n;
+}
+
+static void le_delete(struct line_editor *le, int from, int to)
+{
+    memmove(le->buf + from, le->buf + to, le->len - to);
+    le->len -= to - from;
+    if (le->cursor > to)
+        le->cursor -= to - from;
+    else if (le->cursor > from)
+        le->cursor = from;
+}
+
+static void le_set(struct line_editor *le, const char *s)
+{
+    le->len = le->cursor = 0;
+    le_insert(le, s, strlen(s));
+}
+
+int complete_word(const char *line, int cursor, char *insert, size_t size, int cols);
+
+/**
+ * Reads keys until enter and leaves the line in le->buf.
+ * @param  history line recalled with the up arrow
+ * @return         SUCCESS on enter, EXIT on Ctrl+D on an empty line or EOF
+ */
+static int le_edit(struct line_editor *le, const char *history)
+{
+    char keys[EDIT_READ];
+    int multicode_state = 0; // 1 after ESC, 2 after ESC [ or ESC O, 3 inside ESC [ n
+    char param = 0;
+    char saved[EDIT_BUF];   // the line being typed while a recalled one is shown
+    bool recalled = false;
+    int tabs = 0;           // Tabs pressed in a row
+
+    le_refresh(le);
+    while (1) {
+        // Wait for keys, for an asynchronous prompt segment or for a job
+        // to change state. Negative fds are skipped by poll.
+        struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {prompt_notify_fd(), POLLIN, 0},
+                                {job_notify_fd(), POLLIN, 0}};
+        if (poll(fds, 3, -1) == -1) {
+            if (errno != EINTR)
+                return EXIT;
+            fds[0].revents = fds[1].revents = 0;
+            fds[2].revents = POLLIN; // most likely SIGCHLD
+        }
+        if (fds[2].revents & POLLIN) {
+            jobs_reap();
+            if (jobs_changed()) {
+                // Report above the line being edited, then draw it again
+                le_append(le, "\r\x1b[0K", 5);
+                le_flush(le);
+                jobs_notify();
+                le_refresh(le);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            le->prompt_len = render_prompt(le->prompt, sizeof(le->prompt));
+            le_refresh(le);
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return EXIT;
+
+        int start_len = le->len, start_cursor = le->cursor;
+        bool redraw = false;
+        for (ssize_t i = 0; i < n; ++i) {
+            char c = keys[i];
+            // printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
+            if (c != 9)
+                tabs = 0;
+
+            if (multicode_state == 1) { // handle multi-code keys
+                multicode_state = c == '[' || c == 'O' ? 2 : 0;
+                continue;
+            }
+            if (multicode_state == 2 || multicode_state == 3) {
+                if (c >= '0' && c <= '9') {
+                    param = c;
+                    multicode_state = 3;
+                    continue;
+                }
+                multicode_state = 0;
+                if (c == '~') // ESC [ n ~
+                    c = param == '3' ? 'X' : param == '1' || param == '7' ? 'H' : param == '4' || param == '8' ? 'F' : 0;
+                switch (c) {
+                case 'A': // up arrow
+                    if (!recalled && history[0]) {
+                        memcpy(saved, le->buf, le->len);
+                        saved[le->len] = 0;
+                        le_set(le, history);
+                        recalled = true;
+                    }
+                    break;
+                case 'B': // down arrow
+                    if (recalled) {
+                        le_set(le, saved);
+                        recalled = false;
+                    }
+                    break;
+                case 'C':
+                    if (le->cursor < le->len)
+                        le->cursor++;
+                    break;
+                case 'D':
+                    if (le->cursor > 0)
+                        le->cursor--;
+                    break;
+                case 'H':
+                    le->cursor = 0;
+                    break;
+                case 'F':
+                    le->cursor = le->len;
+                    break;
+                case 'X': // delete
+                    if (le->cursor < le->len)
+                        le_delete(le, le->cursor, le->cursor + 1);
+                    break;
+                }
+                redraw = true;
+                continue;
+            }
+
+            switch (c) {
+            case 27:
+                multicode_state = 1;
+                param = 0;
+                break;
+            case '\r':
+            case '\n': // enter key
+                le->cursor = le->len;
+                le_refresh(le);
+                le_append(le, "\n", 1);
+                le_flush(le);
+                le->buf[le->len] = 0;
+                return SUCCESS;
+            case 9: { // handle tab, a second one in a row lists the candidates
+                char insert[EDIT_BUF];
+                bool list = tabs > 0;
+                int found = complete_word(le->buf, le->cursor, insert, sizeof(insert), list ? le->cols : 0);
+                if (insert[0])
+                    le_insert(le, insert, strlen(insert));
+                else if (found == 0) {
+                    le_append(le, "\a", 1);
+                    le_flush(le);
+                }
+                if (list && found > 1)
+                    redraw = true;
+                tabs++;
+                continue;
+            }
+            case 3: // Ctrl+C, drop the line
+                le->cursor = le->len;
+                le_refresh(le);
+                le_append(le, "^C\n", 3);
+                le_flush(le);
+                le->len = 0;
+                le->buf[0] = 0;
+                return SUCCESS;
+            case 4: // Ctrl+D
+                if (le->len == 0)
+                    return EXIT;
+                if (le->cursor < le->len)
+                    le_delete(le, le->cursor, le->cursor + 1);
+                break;
+            case 127: // handle backspace
+            case 8:
+                if (le->cursor > 0)
+                    le_delete(le, le->cursor - 1, le->cursor);
+                break;
+            case 1: // Ctrl+A
+                le->cursor = 0;
+                break;
+            case 5: // Ctrl+E
+                le->cursor = le->len;
+                break;
+            case 2: // Ctrl+B
+                if (le->cursor > 0)
+                    le->cursor--;
+                break;
+            case 6: // Ctrl+F
+                if (le->cursor < le->len)
+                    le->cursor++;
+                break;
+            case 11: // Ctrl+K
+                le_delete(le, le->cursor, le->len);
+                break;
+            case 21: // Ctrl+U
+                le_delete(le, 0, le->cursor);
+                break;
+            case 23: { // Ctrl+W, delete the word before the cursor
+                int from = le->cursor;
+                while (from > 0 && le->buf[from - 1] == ' ')
+                    from--;
+                while (from > 0 && le->buf[from - 1] != ' ')
+                    from--;
+                le_delete(le, from, le->cursor);
+                break;
+            }
+            case 12: // Ctrl+L
+                le_append(le, "\x1b[H\x1b[2J", 7);
+                redraw = true;
+                break;
+            default:
+                if ((unsigned char)c >= 32)
+                    le_insert(le, &c, 1);
+                break;
+            }
+        }
+
+        // Typing at the end of a line that fits only needs an echo of the
+        // new characters, anything else is a full redraw
+        bool appended = le->cursor == le->len && start_cursor == start_len && le->len > start_len
+                        && le->prompt_len + le->len < le->cols
+                        && memchr(keys, 27, n) == NULL;
+        if (appended && !redraw) {
+            le_append(le, le->buf + start_len, le->len - start_len);
+            le_flush(le);
+        } else if (redraw || le->len != start_len || le->cursor != start_cursor) {
+            le_refresh(le);
+        }
+    }
+}
+
+/**
+ * Prompt a command from the user
+ * @param  command filled with the parsed line
+ * @return         SUCCESS, or EXIT on Ctrl+D / end of input
+ */
+int prompt(struct command_t *command)
+{
+    static struct line_editor le;
+    static char oldbuf[EDIT_BUF];
+
+    // tcgetattr gets the parameters of the current terminal
+    // STDIN_FILENO will tell tcgetattr that it should write the settings
+    // of stdin to oldt
+    static struct termios backup_termios, new_termios;
+    tcgetattr(STDIN_FILENO, &backup_termios);
+    new_termios = backup_termios;
+    // ICANON normally takes care that one line at a time will be processed
+    // that means it will return if it sees a "\n" or an EOF or an EOL
+    new_termios.c_lflag &= ~(ICANON | ECHO | ISIG); // Also disable automatic echo. The editor draws the line.
+    // Those new settings will be set to STDIN
+    // TCSANOW tells tcsetattr to change attributes immediately.
+    tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
+
+    struct winsize ws;
+    le.cols = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    jobs_reap();
+    jobs_notify();
+    le.prompt_len = render_prompt(le.prompt, sizeof(le.prompt));
+    le.len = le.cursor = 0;
+
+    fflush(stdout);
+    int code = le_edit(&le, oldbuf);
+
+    // restore the old settings
+    tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
+    if (code == EXIT)
+        return EXIT;
+
+    if (le.len > 0)
+        strcpy(oldbuf, le.buf);
+
+    parse_command(le.buf, command);
+
+    // print_command(command); // DEBUG: uncomment for debugging
+    return SUCCESS;
+}
+
+int process_command(struct command_t *command);
+int execute_pipeline(struct command_t *command);
+const char *resolve_command(const char *name);
+int spawn_program(char *const argv[], int in_fd, bool wait);
+int hash_builtin(struct command_t *command);
+int isBackground(struct command_t *command);
+struct name_matcher;
+int filesearch_helper(char *directory_name, const struct name_matcher *matcher, const char *content,
+                      bool o_flag, bool r_flag);
+int fsindex_build();
+int fsindex_search(const char *pattern, bool o_flag);
+int change_directory(const char *path);
+void history_open();
+void frecency_init();
+void frecency_visit(const char *path);
+void frecency_save();
+int z_builtin(struct command_t *command);
+int mydev_builtin(struct command_t *command);
+
+int isBackground(struct command_t *command) {
+    for (int i = command->arg_count; i > 0; --i) {
+
+        printf("%s \n", command->args[i]);
+//        if (strcmp(command->args[i], "&") == 0) {
+//            return 1;
+//        }
+    }
+    return 0;
+}
+
+/*
+ * Name matching for filesearch. Several patterns are matched at once:
+ * a SIMD pass looks for the first bytes of all patterns in 16 (SSE2) or
+ * 32 (AVX2) bytes of a name at a time and only candidate positions are
+ * compared in full. The implementation is picked at runtime from what
+ * the CPU supports, with a scalar fallback.
+ *
+ * The SIMD paths read up to NM_PAD bytes past the end of a name, so
+ * names must live in a buffer with that much slack (the getdents64
+ * buffers are allocated with it), which lets a whole batch of entries be
+ * matched in place without copying.
+ */
+#define NM_MAX_FIRST 8
+#define NM_PAD 32
+
+struct name_matcher
+{
+    int count;
+    char **patterns;  // lower-cased in icase mode
+    size_t *lens;     // shortest name a glob can match in glob mode
+    bool icase;
+    bool glob;        // whole-name shell patterns instead of substrings
+    int first_count;  // distinct first bytes, 0 if too many for SIMD
+    unsigned char first[NM_MAX_FIRST];
+    bool (*match)(const struct name_matcher *m, const char *name, size_t len);
+};
+
+static bool nm_verify(const struct name_matcher *m, const char *name, size_t len, size_t pos)
+{
+    for (int i = 0; i < m->count; ++i) {
+        if (pos + m->lens[i] > len)
+            continue;
+        if (m->icase ? strncasecmp(name + pos, m->patterns[i], m->lens[i]) == 0
+                     : memcmp(name + pos, m->patterns[i], m->lens[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool nm_match_scalar(const struct name_matcher *m, const char *name, size_t len)
+{
+    for (int i = 0; i < m->count; ++i)
+        if (m->icase ? strcasestr(name, m->patterns[i]) != NULL
+                     : memmem(name, len, m->patterns[i], m->lens[i]) != NULL)
+            return true;
+    return false;
+}
+
+static bool nm_match_glob(const struct name_matcher *m, const char *name, size_t len)
+{
+    for (int i = 0; i < m->count; ++i)
+        if (m->lens[i] <= len && fnmatch(m->patterns[i], name, m->icase ? FNM_CASEFOLD : 0) == 0)
+            return true;
+    return false;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static bool nm_match_sse2(const struct name_matcher *m, const char *name, size_t len)
+{
+    __m128i first[NM_MAX_FIRST * 2];
+    int first_count = 0;
+    for (int i = 0; i < m->first_count; ++i) {
+        first[first_count++] = _mm_set1_epi8(m->first[i]);
+        if (m->icase && m->first[i] != toupper(m->first[i]))
+            first[first_count++] = _mm_set1_epi8(toupper(m->first[i]));
+    }
+
+    for (size_t off = 0; off < len; off += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(name + off));
+        __m128i eq = _mm_cmpeq_epi8(block, first[0]);
+        for (int i = 1; i < first_count; ++i)
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(block, first[i]));
+        unsigned mask = _mm_movemask_epi8(eq);
+        if (len - off < 16)
+            mask &= (1u << (len - off)) - 1;
+        for (; mask; mask &= mask - 1)
+            if (nm_verify(m, name, len, off + __builtin_ctz(mask)))
+                return true;
+    }
+    return false;
+}
+
+__attribute__((target("avx2")))
+static bool nm_match_avx2(const struct name_matcher *m, const char *name, size_t len)
+{
+    __m256i first[NM_MAX_FIRST * 2];
+    int first_count = 0;
+    for (int i = 0; i < m->first_count; ++i) {
+        first[first_count++] = _mm256_set1_epi8(m->first[i]);
+        if (m->icase && m->first[i] != toupper(m->first[i]))
+            first[first_count++] = _mm256_set1_epi8(toupper(m->first[i]));
+    }
+
+    for (size_t off = 0; off < len; off += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(name + off));
+        __m256i eq = _mm256_cmpeq_epi8(block, first[0]);
+        for (int i = 1; i < first_count; ++i)
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(block, first[i]));
+        uint32_t mask = _mm256_movemask_epi8(eq);
+        if (len - off < 32)
+            mask &= (1u << (len - off)) - 1;
+        for (; mask; mask &= mask - 1)
+            if (nm_verify(m, name, len, off + __builtin_ctz(mask)))
+                return true;
+    }
+    return false;
+}
+#endif
+
+/**
+ * @return the length of the shortest name the shell pattern can match,
+ *         so that shorter names need not go through fnmatch
+ */
+static size_t nm_glob_min_len(const char *p)
+{
+    size_t len = 0;
+    for (; *p; ++p) {
+        if (*p == '*')
+            continue;
+        len++;
+        if (*p == '\\' && p[1]) {
+            ++p;
+        } else if (*p == '[') {
+            // A bracket expression is one character, if it is closed
+            const char *end = p + 1;
+            if (*end == '!' || *end == '^')
+                ++end;
+            if (*end == ']')
+                ++end;
+            while (*end && *end != ']')
+                ++end;
+            if (*end)
+                p = end;
+        }
+    }
+    return len;
+}
+
+/**
+ * Prepares a matcher for the given patterns and picks the fastest
+ * implementation available on this CPU.
+ * @return 0 on success, -1 if there is no non-empty pattern
+ */
+int name_matcher_init(struct name_matcher *m, char **patterns, int count, bool icase, bool glob)
+{
+    memset(m, 0, sizeof(*m));
+    m->patterns = malloc(sizeof(char *) * (count ? count : 1));
+    m->lens = malloc(sizeof(size_t) * (count ? count : 1));
+    m->icase = icase;
+    m->glob = glob;
+
+    for (int i = 0; i < count; ++i) {
+        if (patterns[i][0] == 0)
+            continue;
+        char *p = strdup(patterns[i]);
+        if (icase && !glob)
+            for (char *c = p; *c; ++c)
+                *c = tolower((unsigned char)*c);
+        m->patterns[m->count] = p;
+        m->lens[m->count++] = glob ? nm_glob_min_len(p) : strlen(p);
+
+        if (m->first_count == -1)
+            continue;
+        unsigned char f = p[0];
+        bool seen = false;
+        for (int j = 0; j < m->first_count; ++j)
+            seen |= m->first[j] == f;
+        if (!seen && m->first_count == NM_MAX_FIRST)
+            m->first_count = -1; // too many to filter, compare every position
+        else if (!seen)
+            m->first[m->first_count++] = f;
+    }
+    if (m->first_count == -1)
+        m->first_count = 0;
+    if (m->count == 0)
+        return -1;
+
+    m->match = nm_match_scalar;
+    if (glob)
+        m->match = nm_match_glob;
+#if defined(__x86_64__) || defined(__i386__)
+    else if (m->first_count && __builtin_cpu_supports("avx2"))
+        m->match = nm_match_avx2;
+    else if (m->first_count && __builtin_cpu_supports("sse2"))
+        m->match = nm_match_sse2;
+#endif
+    return 0;
+}
+
+void name_matcher_free(struct name_matcher *m)
+{
+    for (int i = 0; i < m->count; ++i)
+        free(m->patterns[i]);
+    free(m->patterns);
+    free(m->lens);
+}
+
+/*
+ * filesearch engine. Directories are scanned by a pool of threads, each
+ * owning a deque of directories still to be read: a worker pushes and
+ * pops at the bottom of its own deque (depth first, which keeps the
+ * number of open directory fds low) and steals from the top of the
+ * others' when it runs dry. Subdirectories are opened with openat()
+ * relative to their parent's fd and entries are read in bulk with
+ * getdents64.
+ *
+ * In content mode (-c) the regular files are queued as well, so the
+ * files themselves are spread over the pool. Small files are mmap'ed,
+ * bigger ones are streamed with large preads, and both are scanned with
+ * glibc's vectorized memmem/memchr.
+ */
+#define FS_DENTS_BUF (64 * 1024)
+#define FS_OUT_BUF (64 * 1024)
+#define FS_MAX_THREADS 64
+#define FS_MMAP_MAX (64L * 1024 * 1024) // larger files are read in chunks
+#define FS_READ_CHUNK (1024 * 1024)
+#define FS_BINARY_PROBE 8192            // a NUL in here marks a binary file
+#define FS_LINE_MAX 512                 // longest part of a line that is printed
+
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct fs_dir
+{
+    struct fs_dir *parent; // pinned until this directory has been opened
+    bool is_file;          // a file to grep in content mode
+    int fd;
+    atomic_int refs;       // 1 for the scan itself + 1 per unopened child
+    size_t path_len;
+    char path[];           // path shown to the user, e.g. ./src/lib
+};
+
+struct fs_deque
+{
+    pthread_mutex_t lock;
+    struct fs_dir **items;
+    size_t head, tail, cap; // steal at head, push/pop at tail
+};
+
+struct filesearch
+{
+    const struct name_matcher *matcher; // NULL accepts every name
+    bool recursive;
+    const char *content;                // text searched for with -c
+    size_t content_len;
+
+    int thread_count;
+    struct fs_deque *deques;
+    atomic_long pending;   // items queued but not yet handled
+
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+
+    pthread_mutex_t out_lock;
+    char **matches;        // collected for -o
+    int match_count, match_cap;
+    bool collect;
+};
+
+struct fs_worker
+{
+    struct filesearch *fs;
+    int id;
+    char *dents;
+    char *chunk;           // pread buffer for big files
+    char out[FS_OUT_BUF];
+    size_t out_len;
+};
+
+static void fs_deque_push(struct fs_deque *q, struct fs_dir *d)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->cap) {
+        if (q->head > 0) { // reuse the space freed by thieves
+            memmove(q->items, q->items + q->head, (q->tail - q->head) * sizeof(*q->items));
+            q->tail -= q->head;
+            q->head = 0;
+        } else {
+            q->cap = q->cap ? q->cap * 2 : 64;
+            q->items = realloc(q->items, q->cap * sizeof(*q->items));
+        }
+    }
+    q->items[q->tail++] = d;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static struct fs_dir *fs_deque_take(struct fs_deque *q, bool steal)
+{
+    struct fs_dir *d = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head)
+        d = steal ? q->items[q->head++] : q->items[--q->tail];
+    if (q->tail == q->head)
+        q->head = q->tail = 0;
+    pthread_mutex_unlock(&q->lock);
+    return d;
+}
+
+static struct fs_dir *fs_dir_new(struct fs_dir *parent, const char *name, size_t name_len)
+{
+    size_t path_len = parent ? parent->path_len + 1 + name_len : name_len;
+    struct fs_dir *d = malloc(sizeof(struct fs_dir) + path_len + 1);
+    d->parent = parent;
+    d->is_file = false;
+    d->fd = -1;
+    atomic_init(&d->refs, 1);
+    d->path_len = path_len;
+    if (parent) {
+        memcpy(d->path, parent->path, parent->path_len);
+        d->path[parent->path_len] = '/';
+        memcpy(d->path + parent->path_len + 1, name, name_len + 1);
+        atomic_fetch_add(&parent->refs, 1);
+    } else {
+        memcpy(d->path, name, name_len + 1);
+    }
+    return d;
+}
+
+static void fs_dir_put(struct fs_dir *d)
+{
+    if (atomic_fetch_sub(&d->refs, 1) != 1)
+        return;
+    if (d->fd != -1)
+        close(d->fd);
+    free(d);
+}
+
+static void fs_flush(struct fs_worker *w)
+{
+    if (!w->out_len)
+        return;
+    pthread_mutex_lock(&w->fs->out_lock);
+    fwrite(w->out, 1, w->out_len, stdout);
+    pthread_mutex_unlock(&w->fs->out_lock);
+    w->out_len = 0;
+}
+
+/**
+ * Prints a match: the entry's path, followed by the line number and the
+ * line itself for content matches (lineno > 0).
+ */
+static void fs_report(struct fs_worker *w, struct fs_dir *d, const char *name, size_t name_len,
+                      long lineno, const char *text, size_t text_len)
+{
+    if (text_len > FS_LINE_MAX)
+        text_len = FS_LINE_MAX;
+    size_t len = d->path_len + 1 + name_len + 1 + (lineno ? 24 + text_len : 0);
+    if (w->out_len + len > FS_OUT_BUF)
+        fs_flush(w);
+    if (len > FS_OUT_BUF) {
+        // Too long to buffer, write it out in pieces
+        pthread_mutex_lock(&w->fs->out_lock);
+        fwrite(d->path, 1, d->path_len, stdout);
+        putchar('/');
+        fwrite(name, 1, name_len, stdout);
+        if (lineno) {
+            printf(":%ld:", lineno);
+            fwrite(text, 1, text_len, stdout);
+        }
+        putchar('\n');
+        pthread_mutex_unlock(&w->fs->out_lock);
+        return;
+    }
+
+    char *line = w->out + w->out_len;
+    memcpy(line, d->path, d->path_len);
+    line[d->path_len] = '/';
+    memcpy(line + d->path_len + 1, name, name_len);
+    len = d->path_len + 1 + name_len;
+    if (lineno) {
+        len += sprintf(line + len, ":%ld:", lineno);
+        memcpy(line + len, text, text_len);
+        len += text_len;
+    }
+    line[len++] = '\n';
+    w->out_len += len;
+}
+
+/**
+ * Remembers a match for -o.
+ */
+static void fs_collect(struct fs_worker *w, struct fs_dir *d, const char *name, size_t name_len)
+{
+    struct filesearch *fs = w->fs;
+    char *path = malloc(d->path_len + 1 + name_len + 1);
+    memcpy(path, d->path, d->path_len);
+    path[d->path_len] = '/';
+    memcpy(path + d->path_len + 1, name, name_len + 1);
+
+    pthread_mutex_lock(&fs->out_lock);
+    if (fs->match_count == fs->match_cap) {
+        fs->match_cap = fs->match_cap ? fs->match_cap * 2 : 16;
+        fs->matches = realloc(fs->matches, fs->match_cap * sizeof(char *));
+    }
+    fs->matches[fs->match_count++] = path;
+    pthread_mutex_unlock(&fs->out_lock);
+}
+
+/**
+ * Reports every line of buf[0, len) that contains the searched text.
+ * buf must start at the beginning of a line.
+ * @param lineno number of the line buf starts with, advanced past buf
+ * @return       number of matching lines
+ */
+static long fs_grep_lines(struct fs_worker *w, struct fs_dir *d, const char *name, size_t name_len,
+                          const char *buf, size_t len, long *lineno)
+{
+    const struct filesearch *fs = w->fs;
+    const char *cur = buf, *end = buf + len;
+    const char *counted = buf; // start of line number *lineno
+    const char *p;
+    long hits = 0;
+
+    while (cur < end && (p = memmem(cur, end - cur, fs->content, fs->content_len))) {
+        const char *line = memrchr(cur, '\n', p - cur);
+        line = line ? line + 1 : cur;
+        for (const char *q = counted; (q = memchr(q, '\n', line - q)); ++q)
+            (*lineno)++;
+        counted = line;
+
+        const char *line_end = memchr(p, '\n', end - p);
+        if (!line_end)
+            line_end = end;
+        fs_report(w, d, name, name_len, *lineno, line, line_end - line);
+        hits++;
+        cur = line_end + 1;
+    }
+    for (const char *q = counted; (q = memchr(q, '\n', end - q)); ++q)
+        (*lineno)++;
+    return hits;
+}
+
+/**
+ * Searches the contents of one queued file. Binary files are skipped.
+ */
+static void fs_grep_file(struct fs_worker *w, struct fs_dir *d)
+{
+    struct fs_dir *dir = d->parent;
+    const char *name = d->path + dir->path_len + 1;
+    size_t name_len = d->path_len - dir->path_len - 1;
+
+    // O_NONBLOCK keeps a FIFO from stalling the worker, it is skipped below
+    int fd = openat(dir->fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1)
+        return;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    long lineno = 1, hits = 0;
+    if (st.st_size <= FS_MMAP_MAX) {
+        char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            size_t probe = st.st_size < FS_BINARY_PROBE ? st.st_size : FS_BINARY_PROBE;
+            if (!memchr(data, 0, probe))
+                hits = fs_grep_lines(w, dir, name, name_len, data, st.st_size, &lineno);
+            munmap(data, st.st_size);
+        }
+    } else {
+        if (!w->chunk)
+            w->chunk = malloc(FS_READ_CHUNK);
+        size_t carry = 0; // partial last line kept for the next chunk
+        off_t off = 0;
+        ssize_t n;
+        while ((n = pread(fd, w->chunk + carry, FS_READ_CHUNK - carry, off)) > 0) {
+            size_t len = carry + n;
+            if (off == 0 && memchr(w->chunk, 0, len < FS_BINARY_PROBE ? len : FS_BINARY_PROBE)) {
+                carry = 0;
+                break;
+            }
+            off += n;
+            // Only complete lines are scanned, a line longer than the
+            // whole buffer is split
+            const char *last = memrchr(w->chunk, '\n', len);
+            size_t complete = last ? (size_t)(last - w->chunk + 1) : (len == FS_READ_CHUNK ? len : 0);
+            hits += fs_grep_lines(w, dir, name, name_len, w->chunk, complete, &lineno);
+            carry = len - complete;
+            memmove(w->chunk, w->chunk + complete, carry);
+        }
+        if (carry)
+            hits += fs_grep_lines(w, dir, name, name_len, w->chunk, carry, &lineno);
+    }
+    close(fd);
+
+    if (hits && w->fs->collect)
+        fs_collect(w, dir, name, name_len);
+}
+
+/**
+ * Marks one queued item as handled, waking idle workers up when it was
+ * the last one.
+ */
+static void fs_item_done(struct filesearch *fs)
+{
+    if (atomic_fetch_sub(&fs->pending, 1) == 1) {
+        pthread_mutex_lock(&fs->idle_lock);
+        pthread_cond_broadcast(&fs->idle_cond);
+        pthread_mutex_unlock(&fs->idle_lock);
+    }
+}
+
+/**
+ * Reads one directory, reporting matching entries and queueing its
+ * subdirectories on the worker's own deque.
+ */
+static void fs_scan(struct fs_worker *w, struct fs_dir *d)
+{
+    struct filesearch *fs = w->fs;
+
+    if (d->is_file) {
+        fs_grep_file(w, d);
+        fs_dir_put(d->parent);
+        fs_dir_put(d);
+        fs_item_done(fs);
+        return;
+    }
+
+    if (d->parent) {
+        const char *name = d->path + d->parent->path_len + 1;
+        d->fd = openat(d->parent->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        fs_dir_put(d->parent);
+        d->parent = NULL;
+    }
+    if (d->fd == -1) {
+        fs_flush(w);
+        pthread_mutex_lock(&fs->out_lock);
+        fprintf(stderr, "-%s: filesearch: %s: %s\n", sysname, d->path, strerror(errno));
+        pthread_mutex_unlock(&fs->out_lock);
+    }
+
+    long n;
+    while (d->fd != -1 && (n = syscall(SYS_getdents64, d->fd, w->dents, FS_DENTS_BUF)) > 0) {
+        for (long pos = 0; pos < n;) {
+            struct linux_dirent64 *e = (struct linux_dirent64 *)(w->dents + pos);
+            pos += e->d_reclen;
+
+            const char *name = e->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+                continue;
+            size_t name_len = strlen(name);
+
+            bool matched = !fs->matcher || fs->matcher->match(fs->matcher, name, name_len);
+            unsigned char type = e->d_type;
+
+            if (fs->content) {
+                // Queue candidate files, fs_grep_file skips non-regular ones
+                if (matched && (type == DT_REG || type == DT_UNKNOWN)) {
+                    struct fs_dir *f = fs_dir_new(d, name, name_len);
+                    f->is_file = true;
+                    atomic_fetch_add(&fs->pending, 1);
+                    fs_deque_push(&fs->deques[w->id], f);
+                }
+            } else if (matched) {
+                fs_report(w, d, name, name_len, 0, NULL, 0);
+                if (fs->collect)
+                    fs_collect(w, d, name, name_len);
+            }
+
+            if (!fs->recursive)
+                continue;
+            if (type == DT_UNKNOWN) { // some filesystems do not fill d_type
+                struct stat st;
+                if (fstatat(d->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+                    type = DT_DIR;
+            }
+            if (type == DT_DIR) {
+                atomic_fetch_add(&fs->pending, 1);
+                fs_deque_push(&fs->deques[w->id], fs_dir_new(d, name, name_len));
+            }
+        }
+    }
+
+    fs_dir_put(d);
+    fs_item_done(fs);
+}
+
+static void *fs_worker_main(void *arg)
+{
+    struct fs_worker *w = arg;
+    struct filesearch *fs = w->fs;
+
+    while (1) {
+        struct fs_dir *d = fs_deque_take(&fs->deques[w->id], false);
+        for (int i = 1; !d && i < fs->thread_count; ++i)
+            d = fs_deque_take(&fs->deques[(w->id + i) % fs->thread_count], true);
+        if (d) {
+            fs_scan(w, d);
+            continue;
+        }
+
+        // Nothing to steal: either the walk is over or others are still
+        // producing. Wake up periodically instead of spinning.
+        pthread_mutex_lock(&fs->idle_lock);
+        if (atomic_load(&fs->pending) == 0) {
+            pthread_mutex_unlock(&fs->idle_lock);
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&fs->idle_cond, &fs->idle_lock, &deadline);
+        pthread_mutex_unlock(&fs->idle_lock);
+    }
+    fs_flush(w);
+    return NULL;
+}
+
+#define FILESEARCH_OPEN_BATCH 256
+#define FILESEARCH_OPEN_PARALLEL 4
+
+/*
+ * Launchers waiting to be started. At most FILESEARCH_OPEN_PARALLEL of
+ * them run at a time so that opening a few thousand matches does not
+ * fork a few thousand viewers at once; jobs_reap() starts the next one
+ * whenever a running one exits.
+ */
+static struct
+{
+    char ***pending; // argv of each launcher, all strings owned
+    int count, next, cap;
+    pid_t running[FILESEARCH_OPEN_PARALLEL];
+} open_queue;
+
+static void open_queue_free(char **argv)
+{
+    for (char **a = argv; *a; ++a)
+        free(*a);
+    free(argv);
+}
+
+/**
+ * Starts queued launchers while there are free slots.
+ */
+static void open_queue_start()
+{
+    for (int slot = 0; slot < FILESEARCH_OPEN_PARALLEL && open_queue.next < open_queue.count; ++slot) {
+        if (open_queue.running[slot])
+            continue;
+        char **argv = open_queue.pending[open_queue.next++];
+        pid_t pid = spawn_program(argv, -1, false);
+        open_queue_free(argv);
+        if (pid == -1) {
+            // The error would be the same for the rest
+            while (open_queue.next < open_queue.count)
+                open_queue_free(open_queue.pending[open_queue.next++]);
+            break;
+        }
+        open_queue.running[slot] = pid;
+    }
+    if (open_queue.next == open_queue.count) {
+        free(open_queue.pending);
+        open_queue.pending = NULL;
+        open_queue.count = open_queue.next = open_queue.cap = 0;
+    }
+}
+
+/**
+ * Called by jobs_reap() for children that are not part of a job.
+ */
+void filesearch_open_reaped(pid_t pid, int status)
+{
+    if (WIFSTOPPED(status) || WIFCONTINUED(status))
+        return;
+    for (int slot = 0; slot < FILESEARCH_OPEN_PARALLEL; ++slot) {
+        if (open_queue.running[slot] == pid) {
+            open_queue.running[slot] = 0;
+            open_queue_start();
+            return;
+        }
+    }
+}
+
+/**
+ * Opens the given matches and frees the list, without waiting for the
+ * viewers. With gio each batch of FILESEARCH_OPEN_BATCH paths takes one
+ * launcher; xdg-open only takes one file, so it is started once per
+ * match. Launchers are queued behind the ones still running.
+ */
+void filesearch_open(char **matches, int count)
+{
+    bool gio = count > 1 && resolve_command("gio");
+    for (int i = 0; i < count;) {
+        int n = 0;
+        char **argv = malloc(sizeof(char *) * (FILESEARCH_OPEN_BATCH + 3));
+        if (gio) {
+            argv[n++] = strdup("gio");
+            argv[n++] = strdup("open");
+        } else {
+            argv[n++] = strdup("xdg-open");
+        }
+        for (int k = gio ? FILESEARCH_OPEN_BATCH : 1; k > 0 && i < count; --k)
+            argv[n++] = matches[i++];
+        argv[n] = NULL;
+
+        if (open_queue.count == open_queue.cap) {
+            open_queue.cap = open_queue.cap ? open_queue.cap * 2 : 16;
+            open_queue.pending = realloc(open_queue.pending, open_queue.cap * sizeof(char **));
+        }
+        open_queue.pending[open_queue.count++] = argv;
+    }
+    free(matches);
+    open_queue_start();
+}
+
+/**
+ * Searches directory_name for entries accepted by the matcher, or with
+ * content set, for lines containing it in the files accepted by the
+ * matcher. Matches are printed one per line; with o_flag the matching
+ * paths are also opened once the walk is over.
+ */
+int filesearch_helper(char *directory_name, const struct name_matcher *matcher, const char *content,
+                      bool o_flag, bool r_flag)
+{
+    struct filesearch fs = {0};
+    fs.matcher = matcher;
+    fs.content = content;
+    fs.content_len = content ? strlen(content) : 0;
+    fs.recursive = r_flag;
+    fs.collect = o_flag;
+    fs.thread_count = 1;
+    if (r_flag || content) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        fs.thread_count = cpus < 1 ? 1 : cpus > FS_MAX_THREADS ? FS_MAX_THREADS : cpus;
+    }
+    pthread_mutex_init(&fs.idle_lock, NULL);
+    pthread_cond_init(&fs.idle_cond, NULL);
+    pthread_mutex_init(&fs.out_lock, NULL);
+    fs.deques = calloc(fs.thread_count, sizeof(struct fs_deque));
+    for (int i = 0; i < fs.thread_count; ++i)
+        pthread_mutex_init(&fs.deques[i].lock, NULL);
+
+    struct fs_dir *root = fs_dir_new(NULL, directory_name, strlen(directory_name));
+    root->fd = open(directory_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    atomic_init(&fs.pending, 1);
+    fs_deque_push(&fs.deques[0], root);
+
+    fflush(stdout);
+    struct fs_worker *workers = calloc(fs.thread_count, sizeof(struct fs_worker));
+    pthread_t *threads = calloc(fs.thread_count, sizeof(pthread_t));
+    for (int i = 0; i < fs.thread_count; ++i) {
+        workers[i].fs = &fs;
+        workers[i].id = i;
+        workers[i].dents = malloc(FS_DENTS_BUF + NM_PAD);
+        if (i > 0 && pthread_create(&threads[i], NULL, fs_worker_main, &workers[i]) != 0) {
+            free(workers[i].dents); // carry on with fewer threads
+            workers[i].dents = NULL;
+        }
+    }
+    fs_worker_main(&workers[0]);
+    for (int i = 1; i < fs.thread_count; ++i)
+        if (workers[i].dents)
+            pthread_join(threads[i], NULL);
+
+    filesearch_open(fs.matches, fs.match_count);
+
+    for (int i = 0; i < fs.thread_count; ++i) {
+        free(workers[i].dents);
+        free(workers[i].chunk);
+        free(fs.deques[i].items);
+        pthread_mutex_destroy(&fs.deques[i].lock);
+    }
+    free(workers);
+    free(threads);
+    free(fs.deques);
+    pthread_mutex_destroy(&fs.idle_lock);
+    pthread_cond_destroy(&fs.idle_cond);
+    pthread_mutex_destroy(&fs.out_lock);
+    return 0;
+}
+
+/*
+ * Persistent filename index for filesearch -r, built by
+ * "filesearch --index" into FSI_FILE in the current directory.
+ *
+ * The file holds every directory below "." with its mtime, the entries of
+ * each directory stored contiguously, and a sorted table of name trigrams
+ * pointing into posting lists of entry ids. Queries mmap the file, pick
+ * the shortest posting list among the pattern's trigrams and verify the
+ * candidates. Refreshing reuses the entries of every directory whose
+ * mtime did not change, so only modified directories are read again.
+ * Searches do that refresh themselves for whatever changed, found
+ * through inotify watches on the indexed directories.
+ */
+#define FSI_FILE ".shellfyre_index"
+#define FSI_MAGIC "SFYIDX1"
+
+struct fsi_header
+{
+    char magic[8];
+    uint32_t entry_count;
+    uint32_t dir_count;
+    uint32_t trigram_count;
+    uint32_t pad;
+    uint64_t strings_off, strings_size;
+    uint64_t entries_off, dirs_off, trigrams_off, postings_off;
+    uint64_t posting_count;
+};
+
+struct fsi_entry
+{
+    uint32_t dir;
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t is_dir;
+};
+
+struct fsi_dir
+{
+    uint32_t path_off;
+    uint32_t path_len;
+    uint32_t first_entry;
+    uint32_t entry_count;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+struct fsi_trigram
+{
+    uint32_t key;
+    uint32_t count;
+    uint64_t first; // index into the postings array
+};
+
+struct fsi_map
+{
+    void *base;
+    size_t size;
+    ino_t ino; // of the index file, to tell a rewritten one apart
+    const struct fsi_header *header;
+    const char *strings;
+    const struct fsi_entry *entries;
+    const struct fsi_dir *dirs;
+    const struct fsi_trigram *trigrams;
+    const uint32_t *postings;
+};
+
+struct fsi_builder
+{
+    char *strings;
+    size_t strings_len, strings_cap;
+    struct fsi_entry *entries;
+    uint32_t entry_count, entry_cap;
+    struct fsi_dir *dirs;
+    uint32_t dir_count, dir_cap;
+    char *dents;
+
+    const struct fsi_map *old; // previous index, may be NULL
+    const bool *dirty;         // per old dir, NULL to check every mtime
+    uint32_t *old_slots;       // open addressing table of old dir ids + 1
+    uint32_t old_slot_count;
+    uint32_t reused, rescanned;
+};
+
+/*
+ * Directories of the index are watched with inotify once a search has
+ * checked them, so that later searches learn what changed by draining
+ * the queue instead of calling stat on every directory. The watches are
+ * only trusted for the index file and directory they were set up for.
+ */
+static struct
+{
+    int fd;          // inotify instance, -1 when not watching
+    dev_t dev;       // the indexed directory
+    ino_t root_ino;
+    ino_t index_ino; // the index the watches describe
+    char **paths;    // indexed path of each watch descriptor
+    int path_cap;
+} fsi_watch = {-1, 0, 0, 0, NULL, 0};
+
+static uint32_t fsi_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t fsi_key(const char *s)
+{
+    return (uint32_t)(unsigned char)s[0] << 16 | (uint32_t)(unsigned char)s[1] << 8 | (unsigned char)s[2];
+}
+
+/**
+ * Whether count elements of size bytes at off lie within the file and
+ * are aligned for them, without overflowing on the way.
+ */
+static bool fsi_section_ok(size_t file_size, uint64_t off, uint64_t count, size_t size, size_t align)
+{
+    return off <= file_size && off % align == 0 && count <= (file_size - off) / size;
+}
+
+/**
+ * Maps an index file and checks that all of its sections are in bounds.
+ * Offsets within the sections are checked where they are used.
+ * @return 0 on success, -1 if the file is missing or malformed
+ */
+static int fsi_open(struct fsi_map *map)
+{
+    memset(map, 0, sizeof(*map));
+    int fd = open(FSI_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct fsi_header)) {
+        close(fd);
+        return -1;
+    }
+    map->size = st.st_size;
+    map->ino = st.st_ino;
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map->base == MAP_FAILED) {
+        map->base = NULL;
+        return -1;
+    }
+
+    const struct fsi_header *h = map->header = map->base;
+    if (memcmp(h->magic, FSI_MAGIC, sizeof(h->magic)) != 0
+        || !fsi_section_ok(map->size, h->strings_off, h->strings_size, 1, 1)
+        || !fsi_section_ok(map->size, h->entries_off, h->entry_count, sizeof(struct fsi_entry), 8)
+        || !fsi_section_ok(map->size, h->dirs_off, h->dir_count, sizeof(struct fsi_dir), 8)
+        || !fsi_section_ok(map->size, h->trigrams_off, h->trigram_count, sizeof(struct fsi_trigram), 8)
+        || !fsi_section_ok(map->size, h->postings_off, h->posting_count, sizeof(uint32_t), 4)) {
+        munmap(map->base, map->size);
+        map->base = NULL;
+        return -1;
+    }
+    map->strings = (const char *)map->base + h->strings_off;
+    map->entries = (const void *)((const char *)map->base + h->entries_off);
+    map->dirs = (const void *)((const char *)map->base + h->dirs_off);
+    map->trigrams = (const void *)((const char *)map->base + h->trigrams_off);
+    map->postings = (const void *)((const char *)map->base + h->postings_off);
+    return 0;
+}
+
+static void fsi_close(struct fsi_map *map)
+{
+    if (map->base)
+        munmap(map->base, map->size);
+    map->base = NULL;
+}
+
+/**
+ * @return the NUL terminated string of len bytes at off, NULL unless it
+ *         lies within the string section
+ */
+static const char *fsi_string(const struct fsi_map *map, uint64_t off, uint64_t len)
+{
+    uint64_t size = map->header->strings_size;
+    if (off >= size || len >= size - off || map->strings[off + len] != 0)
+        return NULL;
+    return map->strings + off;
+}
+
+/**
+ * @return directory id of the index, NULL if it is out of range or its
+ *         path or entries are
+ */
+static const struct fsi_dir *fsi_dir_at(const struct fsi_map *map, uint32_t id)
+{
+    if (id >= map->header->dir_count)
+        return NULL;
+    const struct fsi_dir *d = &map->dirs[id];
+    if (!fsi_string(map, d->path_off, d->path_len) || d->first_entry > map->header->entry_count
+        || d->entry_count > map->header->entry_count - d->first_entry)
+        return NULL;
+    return d;
+}
+
+/**
+ * @return entry id of the index, NULL if it is out of range, its name is,
+ *         or the name could lead out of its directory
+ */
+static const struct fsi_entry *fsi_entry_at(const struct fsi_map *map, uint64_t id)
+{
+    if (id >= map->header->entry_count)
+        return NULL;
+    const struct fsi_entry *e = &map->entries[id];
+    const char *name = fsi_string(map, e->name_off, e->name_len);
+    if (!name || e->dir >= map->header->dir_count || e->name_len == 0 || memchr(name, '/', e->name_len)
+        || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return NULL;
+    return e;
+}
+
+static void fsi_watch_stop()
+{
+    if (fsi_watch.fd != -1)
+        close(fsi_watch.fd);
+    fsi_watch.fd = -1;
+    for (int i = 0; i < fsi_watch.path_cap; ++i)
+        free(fsi_watch.paths[i]);
+    free(fsi_watch.paths);
+    fsi_watch.paths = NULL;
+    fsi_watch.path_cap = 0;
+}
+
+/**
+ * Starts over with no watches, for the directory the shell is in.
+ */
+static void fsi_watch_start()
+{
+    struct stat st;
+    fsi_watch_stop();
+    if (stat(".", &st) == -1)
+        return;
+    fsi_watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    fsi_watch.dev = st.st_dev;
+    fsi_watch.root_ino = st.st_ino;
+}
+
+/**
+ * Watches an indexed directory for entries coming and going. Running out
+ * of watches turns watching off, searches then check mtimes again.
+ */
+static void fsi_watch_add(const char *path)
+{
+    if (fsi_watch.fd == -1)
+        return;
+    int wd = inotify_add_watch(fsi_watch.fd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                                                     | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd < 0) {
+        fsi_watch_stop();
+        return;
+    }
+    if (wd >= fsi_watch.path_cap) {
+        int cap = fsi_watch.path_cap ? fsi_watch.path_cap : 256;
+        while (cap <= wd)
+            cap *= 2;
+        fsi_watch.paths = realloc(fsi_watch.paths, cap * sizeof(char *));
+        memset(fsi_watch.paths + fsi_watch.path_cap, 0, (cap - fsi_watch.path_cap) * sizeof(char *));
+        fsi_watch.path_cap = cap;
+    }
+    // A directory that moved keeps its watch, under its new path
+    free(fsi_watch.paths[wd]);
+    fsi_watch.paths[wd] = strdup(path);
+}
+
+/**
+ * Whether the watches describe this index of the current directory.
+ */
+static bool fsi_watch_valid(const struct fsi_map *map)
+{
+    struct stat st;
+    return fsi_watch.fd != -1 && fsi_watch.index_ino == map->ino && stat(".", &st) == 0
+           && st.st_dev == fsi_watch.dev && st.st_ino == fsi_watch.root_ino;
+}
+
+/**
+ * Fills the open addressing table of b->old's directories by path.
+ */
+static void fsi_old_slots(struct fsi_builder *b, const struct fsi_map *old)
+{
+    b->old = old;
+    b->old_slot_count = old->header->dir_count * 2 + 1;
+    b->old_slots = calloc(b->old_slot_count, sizeof(uint32_t));
+    for (uint32_t i = 0; i < old->header->dir_count; ++i) {
+        const struct fsi_dir *d = fsi_dir_at(old, i);
+        if (!d)
+            continue;
+        uint32_t slot = fsi_hash(old->strings + d->path_off, d->path_len) % b->old_slot_count;
+        while (b->old_slots[slot])
+            slot = (slot + 1) % b->old_slot_count;
+        b->old_slots[slot] = i + 1;
+    }
+}
+
+/**
+ * Looks a directory up in the previous index.
+ * @return the old directory, NULL if it was not indexed
+ */
+static const struct fsi_dir *fsi_old_dir(struct fsi_builder *b, const char *path, size_t len)
+{
+    if (!b->old_slot_count)
+        return NULL;
+    for (uint32_t i = fsi_hash(path, len) % b->old_slot_count;; i = (i + 1) % b->old_slot_count) {
+        uint32_t slot = b->old_slots[i];
+        if (!slot)
+            return NULL;
+        const struct fsi_dir *d = &b->old->dirs[slot - 1];
+        if (d->path_len == len && memcmp(b->old->strings + d->path_off, path, len) == 0)
+            return d;
+    }
+}
+
+/**
+ * Marks the directories the queued events are about as dirty.
+ * @return 0, or -1 if events were lost and every directory must be checked
+ */
+static int fsi_watch_drain(struct fsi_builder *b, bool *dirty)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(fsi_watch.fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW)
+                return -1;
+            if (ev->wd < 0 || ev->wd >= fsi_watch.path_cap || !fsi_watch.paths[ev->wd])
+                continue;
+            const char *path = fsi_watch.paths[ev->wd];
+            if (ev->mask & IN_IGNORED) {
+                free(fsi_watch.paths[ev->wd]);
+                fsi_watch.paths[ev->wd] = NULL;
+                continue;
+            }
+            // Writing the index is not a change to what it indexes
+            if (ev->len && strcmp(path, ".") == 0
+                && (strcmp(ev->name, FSI_FILE) == 0 || strcmp(ev->name, FSI_FILE ".tmp") == 0))
+                continue;
+            const struct fsi_dir *d = fsi_old_dir(b, path, strlen(path));
+            if (d)
+                dirty[d - b->old->dirs] = true;
+        }
+    }
+    return n == -1 && errno != EAGAIN ? -1 : 0;
+}
+
+static uint32_t fsi_add_string(struct fsi_builder *b, const char *s, size_t len)
+{
+    if (b->strings_len + len + 1 > b->strings_cap) {
+        b->strings_cap = (b->strings_len + len + 1) * 2;
+        b->strings = realloc(b->strings, b->strings_cap);
+    }
+    uint32_t off = b->strings_len;
+    memcpy(b->strings + off, s, len);
+    b->strings[off + len] = 0;
+    b->strings_len += len + 1;
+    return off;
+}
+
+static void fsi_add_entry(struct fsi_builder *b, uint32_t dir, const char *name, size_t len, bool is_dir)
+{
+    if (b->entry_count == b->entry_cap) {
+        b->entry_cap = b->entry_cap ? b->entry_cap * 2 : 1024;
+        b->entries = realloc(b->entries, b->entry_cap * sizeof(struct fsi_entry));
+    }
+    struct fsi_entry *e = &b->entries[b->entry_count++];
+    e->dir = dir;
+    e->name_off = fsi_add_string(b, name, len);
+    e->name_len = len;
+    e->is_dir = is_dir;
+}
+
+/**
+ * Indexes one directory and everything below it. A directory the
+ * watches vouch for is copied from the old index without touching it.
+ * @param parent_fd open fd of the parent, -1 to open path itself
+ * @param name      name of the directory in its parent
+ * @param path      path of the directory as shown to the user
+ */
+static void fsi_build_dir(struct fsi_builder *b, int parent_fd, const char *name, const char *path,
+                          size_t path_len)
+{
+    const struct fsi_dir *old = fsi_old_dir(b, path, path_len);
+    bool trusted = old && b->dirty && !b->dirty[old - b->old->dirs];
+    struct stat st;
+    int fd = -1;
+    if (!trusted) {
+        fd = parent_fd == -1 ? open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+                             : openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1)
+            return;
+        // Watch before reading, so that no change falls in between
+        fsi_watch_add(path);
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            return;
+        }
+    }
+
+    if (b->dir_count == b->dir_cap) {
+        b->dir_cap = b->dir_cap ? b->dir_cap * 2 : 256;
+        b->dirs = realloc(b->dirs, b->dir_cap * sizeof(struct fsi_dir));
+    }
+    uint32_t dir_id = b->dir_count++;
+    struct fsi_dir *d = &b->dirs[dir_id];
+    d->path_off = fsi_add_string(b, path, path_len);
+    d->path_len = path_len;
+    d->first_entry = b->entry_count;
+    d->mtime_sec = trusted ? old->mtime_sec : st.st_mtim.tv_sec;
+    d->mtime_nsec = trusted ? old->mtime_nsec : st.st_mtim.tv_nsec;
+
+    if (trusted || (old && old->mtime_sec == st.st_mtim.tv_sec && old->mtime_nsec == st.st_mtim.tv_nsec)) {
+        // Unchanged since the last run, take the entries over as they are
+        for (uint32_t i = 0; i < old->entry_count; ++i) {
+            const struct fsi_entry *e = fsi_entry_at(b->old, (uint64_t)old->first_entry + i);
+            if (e)
+                fsi_add_entry(b, dir_id, b->old->strings + e->name_off, e->name_len, e->is_dir);
+        }
+        b->reused++;
+    } else {
+        long n;
+        while ((n = syscall(SYS_getdents64, fd, b->dents, FS_DENTS_BUF)) > 0) {
+            for (long pos = 0; pos < n;) {
+                struct linux_dirent64 *e = (struct linux_dirent64 *)(b->dents + pos);
+                pos += e->d_reclen;
+
+                const char *name = e->d_name;
+                if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+                    continue;
+                if (dir_id == 0 && (strcmp(name, FSI_FILE) == 0 || strcmp(name, FSI_FILE ".tmp") == 0))
+                    continue;
+                unsigned char type = e->d_type;
+                if (type == DT_UNKNOWN) {
+                    struct stat est;
+                    if (fstatat(fd, name, &est, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(est.st_mode))
+                        type = DT_DIR;
+                }
+                fsi_add_entry(b, dir_id, name, strlen(name), type == DT_DIR);
+            }
+        }
+        b->rescanned++;
+    }
+    b->dirs[dir_id].entry_count = b->entry_count - b->dirs[dir_id].first_entry;
+
+    // Descend after the entries are in place so that they stay contiguous.
+    // The arrays may move while recursing, so only indices are kept.
+    uint32_t first = b->dirs[dir_id].first_entry, count = b->dirs[dir_id].entry_count;
+    char child[PATH_MAX];
+    for (uint32_t i = first; i < first + count; ++i) {
+        if (!b->entries[i].is_dir)
+            continue;
+        const char *name = b->strings + b->entries[i].name_off;
+        int len = snprintf(child, sizeof(child), "%s/%s", path, name);
+        if (len < (int)sizeof(child))
+            fsi_build_dir(b, fd, b->strings + b->entries[i].name_off, child, len);
+    }
+    if (fd != -1)
+        close(fd);
+}
+
+static int fsi_compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Writes a new index of the current directory and atomically replaces
+ * FSI_FILE, reusing what it can from the old one.
+ * @param  old     previous index, NULL if there is none
+ * @param  dirty   per directory of old, whether it has to be read again;
+ *                 NULL to compare the mtime of every directory
+ * @param  verbose whether to report what was done
+ * @return         0 on success, -1 on error
+ */
+static int fsi_write(const struct fsi_map *old, const bool *dirty, bool verbose)
+{
+    struct fsi_builder b = {0};
+    if (old)
+        fsi_old_slots(&b, old);
+    b.dirty = dirty;
+    b.dents = malloc(FS_DENTS_BUF);
+    fsi_build_dir(&b, -1, ".", ".", 1);
+    free(b.dents);
+    free(b.old_slots);
+
+    // Every (trigram, entry) pair, sorted, gives the posting lists in order
+    size_t pair_count = 0, pair_cap = 0;
+    uint64_t *pairs = NULL;
+    for (uint32_t i = 0; i < b.entry_count; ++i) {
+        const char *name = b.strings + b.entries[i].name_off;
+        for (uint32_t j = 0; j + 3 <= b.entries[i].name_len; ++j) {
+            if (pair_count == pair_cap) {
+                pair_cap = pair_cap ? pair_cap * 2 : 4096;
+                pairs = realloc(pairs, pair_cap * sizeof(uint64_t));
+            }
+            pairs[pair_count++] = (uint64_t)fsi_key(name + j) << 32 | i;
+        }
+    }
+    qsort(pairs, pair_count, sizeof(uint64_t), fsi_compare_u64);
+
+    uint32_t *postings = malloc((pair_count ? pair_count : 1) * sizeof(uint32_t));
+    struct fsi_trigram *trigrams = malloc((pair_count ? pair_count : 1) * sizeof(struct fsi_trigram));
+    uint64_t posting_count = 0;
+    uint32_t trigram_count = 0;
+    for (size_t i = 0; i < pair_count; ++i) {
+        if (i > 0 && pairs[i] == pairs[i - 1])
+            continue; // trigram repeated within one name
+        uint32_t key = pairs[i] >> 32;
+        if (trigram_count == 0 || trigrams[trigram_count - 1].key != key) {
+            trigrams[trigram_count].key = key;
+            trigrams[trigram_count].count = 0;
+            trigrams[trigram_count].first = posting_count;
+            trigram_count++;
+        }
+        trigrams[trigram_count - 1].count++;
+        postings[posting_count++] = (uint32_t)pairs[i];
+    }
+    free(pairs);
+
+    struct fsi_header h = {0};
+    memcpy(h.magic, FSI_MAGIC, sizeof(h.magic));
+    h.entry_count = b.entry_count;
+    h.dir_count = b.dir_count;
+    h.trigram_count = trigram_count;
+    h.posting_count = posting_count;
+    h.strings_off = sizeof(h);
+    h.strings_size = b.strings_len;
+    h.entries_off = (h.strings_off + h.strings_size + 7) & ~7ull;
+    h.dirs_off = h.entries_off + (uint64_t)b.entry_count * sizeof(struct fsi_entry);
+    h.trigrams_off = h.dirs_off + (uint64_t)b.dir_count * sizeof(struct fsi_dir);
+    h.postings_off = h.trigrams_off + (uint64_t)trigram_count * sizeof(struct fsi_trigram);
+
+    int r = -1;
+    static const char pad[8];
+    FILE *out = fopen(FSI_FILE ".tmp", "w");
+    if (out) {
+        fwrite(&h, sizeof(h), 1, out);
+        fwrite(b.strings, 1, b.strings_len, out);
+        fwrite(pad, 1, h.entries_off - h.strings_off - h.strings_size, out);
+        fwrite(b.entries, sizeof(struct fsi_entry), b.entry_count, out);
+        fwrite(b.dirs, sizeof(struct fsi_dir), b.dir_count, out);
+        fwrite(trigrams, sizeof(struct fsi_trigram), trigram_count, out);
+        fwrite(postings, sizeof(uint32_t), posting_count, out);
+        if (fclose(out) == 0 && rename(FSI_FILE ".tmp", FSI_FILE) == 0)
+            r = 0;
+    }
+    if (r == 0) {
+        // Writing the index itself touched ".", record its final mtime
+        struct stat st;
+        int fd = open(FSI_FILE, O_WRONLY | O_CLOEXEC);
+        if (fd != -1 && stat(".", &st) == 0) {
+            int64_t mtime[2] = {st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+            if (pwrite(fd, mtime, sizeof(mtime), h.dirs_off + offsetof(struct fsi_dir, mtime_sec)) == -1)
+                r = -1;
+        }
+        if (fd != -1 && fstat(fd, &st) == 0)
+            fsi_watch.index_ino = st.st_ino;
+        if (fd != -1)
+            close(fd);
+    }
+    if (r == 0 && verbose)
+        printf("Indexed %u entries in %u directories (%u unchanged, %u read).\n",
+               b.entry_count, b.dir_count, b.reused, b.rescanned);
+    else if (r != 0)
+        printf("-%s: filesearch: cannot write %s: %s\n", sysname, FSI_FILE, strerror(errno));
+
+    free(trigrams);
+    free(postings);
+    free(b.strings);
+    free(b.entries);
+    free(b.dirs);
+    return r;
+}
+
+/**
+ * filesearch --index: builds or refreshes the index of the current
+ * directory, comparing the mtime of every directory.
+ * @return 0 on success, -1 on error
+ */
+int fsindex_build()
+{
+    struct fsi_map old;
+    bool has_old = fsi_open(&old) == 0;
+    fsi_watch_start();
+    int r = fsi_write(has_old ? &old : NULL, NULL, true);
+    if (r != 0)
+        fsi_watch_stop();
+    fsi_close(&old);
+    return r;
+}
+
+static const struct fsi_trigram *fsi_find_trigram(const struct fsi_map *map, uint32_t key)
+{
+    uint32_t lo = 0, hi = map->header->trigram_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (map->trigrams[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < map->header->trigram_count && map->trigrams[lo].key == key)
+        return &map->trigrams[lo];
+    return NULL;
+}
+
+static void fsi_report(const struct fsi_map *map, uint64_t id, size_t pattern_len, const char *pattern,
+                       char ***matches, int *match_count, bool collect)
+{
+    const struct fsi_entry *e = fsi_entry_at(map, id);
+    const struct fsi_dir *d = e ? fsi_dir_at(map, e->dir) : NULL;
+    if (!d)
+        return;
+    const char *name = map->strings + e->name_off;
+    if (!memmem(name, e->name_len, pattern, pattern_len))
+        return;
+    printf("%s/%s\n", map->strings + d->path_off, name);
+    if (collect) {
+        *matches = realloc(*matches, (*match_count + 1) * sizeof(char *));
+        // Without memory the match is printed but not opened
+        if (asprintf(&(*matches)[*match_count], "%s/%s", map->strings + d->path_off, name) != -1)
+            (*match_count)++;
+    }
+}
+
+/**
+ * Brings the index up to date before a query. With valid watches only
+ * the directories they reported are read again; otherwise every mtime is
+ * compared once, setting up the watches on the way.
+ * @return 0 if map is usable, possibly reopened, -1 if it is not
+ */
+static int fsi_refresh(struct fsi_map *map)
+{
+    struct fsi_builder b = {0};
+    fsi_old_slots(&b, map);
+    bool *dirty = calloc(map->header->dir_count ? map->header->dir_count : 1, sizeof(bool));
+    bool any = false;
+
+    if (!fsi_watch_valid(map) || fsi_watch_drain(&b, dirty) == -1) {
+        fsi_watch_start();
+        fsi_watch.index_ino = map->ino;
+        memset(dirty, 0, map->header->dir_count * sizeof(bool));
+        struct stat st;
+        for (uint32_t i = 0; i < map->header->dir_count; ++i) {
+            const struct fsi_dir *d = fsi_dir_at(map, i);
+            if (!d) {
+                free(dirty);
+                free(b.old_slots);
+                fsi_watch_stop();
+                return -1;
+            }
+            const char *path = map->strings + d->path_off;
+            fsi_watch_add(path);
+            dirty[i] = stat(path, &st) != 0 || st.st_mtim.tv_sec != d->mtime_sec
+                       || st.st_mtim.tv_nsec != d->mtime_nsec;
+        }
+    }
+    for (uint32_t i = 0; i < map->header->dir_count && !any; ++i)
+        any = dirty[i];
+    free(b.old_slots);
+
+    int r = 0;
+    if (any) {
+        struct fsi_map fresh;
+        r = fsi_write(map, dirty, false) == 0 && fsi_open(&fresh) == 0 ? 0 : -1;
+        if (r == 0) {
+            fsi_close(map);
+            *map = fresh;
+        } else {
+            fsi_watch_stop(); // what the watches reported is not in the index
+        }
+    }
+    free(dirty);
+    return r;
+}
+
+/**
+ * Answers a recursive filesearch from the index of the current directory,
+ * refreshing the directories that changed since it was written.
+ * @return 0 if the query was answered, -1 if there is no usable index
+ *         and the caller should walk the tree instead
+ */
+int fsindex_search(const char *pattern, bool o_flag)
+{
+    struct fsi_map map;
+    if (fsi_open(&map) != 0)
+        return -1;
+    if (fsi_refresh(&map) != 0) {
+        fsi_close(&map);
+        return -1;
+    }
+
+    char **matches = NULL;
+    int match_count = 0;
+    size_t len = strlen(pattern);
+    if (len < 3) {
+        for (uint32_t i = 0; i < map.header->entry_count; ++i)
+            fsi_report(&map, i, len, pattern, &matches, &match_count, o_flag);
+    } else {
+        // Every match contains all trigrams of the pattern, so the
+        // shortest posting list is a complete candidate set
+        const struct fsi_trigram *best = NULL;
+        for (size_t i = 0; i + 3 <= len; ++i) {
+            const struct fsi_trigram *t = fsi_find_trigram(&map, fsi_key(pattern + i));
+            if (!t) {
+                best = NULL;
+                break;
+            }
+            if (t->first > map.header->posting_count || t->count > map.header->posting_count - t->first) {
+                fsi_close(&map);
+                return -1;
+            }
+            if (!best || t->count < best->count)
+                best = t;
+        }
+        for (uint32_t i = 0; best && i < best->count; ++i)
+            fsi_report(&map, map.postings[best->first + i], len, pattern, &matches, &match_count, o_flag);
+    }
+    fsi_close(&map);
+
+    if (o_flag)
+        filesearch_open(matches, match_count);
+    return 0;
+}
+
+/*
+ * cdh history store. Directories are appended as lines to
+ * CDH_HISTORY_FILE and the offset of every line is appended to
+ * CDH_INDEX_FILE, which is mmap'ed. Reading the last n entries is then n
+ * index lookups and n preads, no matter how long the history is.
+ */
+#define CDH_HISTORY_FILE "/home/cdh_history.txt"
+#define CDH_INDEX_FILE "/home/cdh_history.idx"
+#define CDH_SHOWN 10
+
+static struct
+{
+    int rec_fd;
+    int idx_fd;
+    const uint64_t *offsets; // mmap of the index
+    size_t mapped;           // bytes mapped
+} history = {-1, -1, NULL, 0};
+
+/**
+ * Maps whatever the index holds right now.
+ * @return number of entries
+ */
+static size_t history_count()
+{
+    struct stat st;
+    if (history.idx_fd == -1 || fstat(history.idx_fd, &st) == -1)
+        return 0;
+    size_t size = st.st_size - st.st_size % sizeof(uint64_t);
+    if (size != history.mapped) {
+        if (history.offsets)
+            munmap((void *)history.offsets, history.mapped);
+        history.offsets = NULL;
+        history.mapped = 0;
+        if (size) {
+            void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, history.idx_fd, 0);
+            if (m == MAP_FAILED)
+                return 0;
+            history.offsets = m;
+            history.mapped = size;
+        }
+    }
+    return history.mapped / sizeof(uint64_t);
+}
+
+/**
+ * Reads entry i of the history into buf.
+ * @return 0 on success, -1 on error
+ */
+static int history_get(size_t i, char *buf, size_t size)
+{
+    ssize_t n = pread(history.rec_fd, buf, size - 1, history.offsets[i]);
+    if (n <= 0)
+        return -1;
+    buf[n] = 0;
+    char *nl = memchr(buf, '\n', n);
+    if (nl)
+        *nl = 0;
+    return 0;
+}
+
+/**
+ * Recreates the index from the records, for histories written before
+ * there was an index or after a crash between the two appends.
+ */
+static void history_reindex()
+{
+    if (ftruncate(history.idx_fd, 0) == -1)
+        return;
+    char *buf = malloc(64 * 1024);
+    if (!buf)
+        return;
+
+    uint64_t *offsets = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t off = 0;
+    bool line_start = true;
+    ssize_t n;
+    while ((n = pread(history.rec_fd, buf, 64 * 1024, off)) > 0) {
+        // A line starts at the beginning and after every newline but the last
+        for (char *p = buf, *end = buf + n; p < end; ++p) {
+            if (line_start) {
+                if (count == cap) {
+                    cap = cap ? cap * 2 : 1024;
+                    offsets = realloc(offsets, cap * sizeof(uint64_t));
+                }
+                offsets[count++] = off + (p - buf);
+            }
+            char *nl = memchr(p, '\n', end - p);
+            line_start = nl != NULL;
+            if (!nl)
+                break;
+            p = nl;
+        }
+        off += n;
+    }
+    free(buf);
+    ssize_t size = count * sizeof(uint64_t);
+    if (count && write(history.idx_fd, offsets, size) != size) {
+        // A partial index would map entries to the wrong lines. An empty
+        // one next to a non-empty record file is rebuilt by history_open.
+        if (ftruncate(history.idx_fd, 0) == -1) {
+            // its last entry does not end the file, which is rebuilt too
+        }
+    }
+    free(offsets);
+}
+
+/**
+ * Opens and maps the history, repairing the index when it does not
+ * cover the record file exactly.
+ */
+void history_open()
+{
+    history.rec_fd = open(CDH_HISTORY_FILE, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    history.idx_fd = open(CDH_INDEX_FILE, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (history.rec_fd == -1 || history.idx_fd == -1)
+        return;
+
+    struct stat st;
+    fstat(history.rec_fd, &st);
+    size_t count = history_count();
+    bool consistent = st.st_size == 0 ? count == 0 : count > 0;
+    if (consistent && count) {
+        // The last indexed line must end exactly at the end of the file
+        char buf[PATH_MAX + 1];
+        uint64_t last = history.offsets[count - 1];
+        consistent = last < (uint64_t)st.st_size && history_get(count - 1, buf, sizeof(buf)) == 0
+                     && last + strlen(buf) + 1 == (uint64_t)st.st_size;
+    }
+    if (!consistent) {
+        history_reindex();
+        history_count();
+    }
+}
+
+/**
+ * Appends a directory to the history.
+ */
+void history_add(const char *path)
+{
+    if (history.rec_fd == -1 || history.idx_fd == -1)
+        return;
+    size_t len = strlen(path);
+    char *line = malloc(len + 1);
+    memcpy(line, path, len);
+    line[len] = '\n';
+    // With O_APPEND the position after the write is the end of our line,
+    // even if another shell appended in the meantime
+    if (write(history.rec_fd, line, len + 1) == (ssize_t)len + 1) {
+        uint64_t off = lseek(history.rec_fd, 0, SEEK_CUR) - (len + 1);
+        // Out of step with the record file, every later entry would be
+        // off by one; rebuild the index from the records instead
+        if (write(history.idx_fd, &off, sizeof(off)) != sizeof(off))
+            history_reindex();
+    }
+    free(line);
+}
+
+/**
+ * Prints the last n directories in the history of the user and changes
+ * into the one they pick.
+ */
+void print_history(int n)
+{
+    size_t count = history_count();
+    if (count == 0) {
+        printf("\n\nWARNING! Not enough directories in the history.\n\n");
+        return;
+    }
+    if ((size_t)n > count)
+        n = count;
+
+    char (*entries)[PATH_MAX] = malloc((size_t)n * PATH_MAX);
+    for (int i = 0; i < n; ++i)
+        if (history_get(count - 1 - i, entries[i], PATH_MAX) != 0)
+            entries[i][0] = 0;
+
+    // Oldest first, the most recent one is "a 1)"
+    for (int i = n - 1; i >= 0; --i)
+        printf("%c %d) %s\n", 'a' + i, i + 1, entries[i]);
+
+    printf("Select a directory by letter or number: ");
+    fflush(stdout);
+    char choice[32];
+    int picked = -1;
+    if (fgets(choice, sizeof(choice), stdin)) {
+        if (choice[0] >= 'a' && choice[0] < 'a' + n)
+            picked = choice[0] - 'a';
+        else if (atoi(choice) >= 1 && atoi(choice) <= n)
+            picked = atoi(choice) - 1;
+    }
+
+    if (picked == -1)
+        printf("No directory selected.\n");
+    else if (change_directory(entries[picked]) != 0)
+        printf("chdir failed - %s\n", strerror(errno));
+    free(entries);
+}
+
+/*
+ * Frecency ranking for the z builtin. Every directory change bumps a
+ * (visit count, last visit) pair kept in a hash map keyed by the
+ * canonical path. On disk the map is a snapshot, FRECENCY_FILE, plus a
+ * log of the visits made since, FRECENCY_LOG: a cd appends one record
+ * to the log, so no visit is lost when the shell is killed, and shells
+ * running at the same time never overwrite each other's. The log is
+ * folded into the snapshot at exit once it gets big. Appends hold a
+ * shared flock on the log and the rewrite an exclusive one. The map is
+ * only loaded the first time z is used, so a big history never slows
+ * down startup or cd.
+ */
+#define FRECENCY_FILE "/home/cdh_frecency.dat"
+#define FRECENCY_LOG FRECENCY_FILE ".log"
+#define FRECENCY_COMPACT_SIZE (64 * 1024) // log size that gets folded in at exit
+#define FRECENCY_MAGIC "SFYZ001"
+#define FRECENCY_MAX_VISITS 10000 // counts are halved past this total
+#define Z_LISTED 10
+
+struct frecency_entry
+{
+    char *path;
+    uint32_t visits;
+    int64_t last_visit;
+};
+
+// On-disk record, followed by path_len bytes of path
+struct frecency_record
+{
+    uint32_t visits;
+    uint32_t path_len;
+    int64_t last_visit;
+};
+
+static struct
+{
+    bool loaded;
+    bool seeded;         // the snapshot is known to exist
+    int log_fd;
+    size_t history_base; // cdh history entries made before this session
+    struct frecency_entry *entries;
+    uint32_t count, cap;
+    uint32_t *slots; // open addressing, entry index + 1, 0 if free
+    uint32_t slot_count;
+    uint64_t total_visits;
+} frecency = {.log_fd = -1};
+
+static struct frecency_entry *frecency_lookup(const char *path, bool create)
+{
+    if ((frecency.count + 1) * 2 > frecency.slot_count) {
+        free(frecency.slots);
+        frecency.slot_count = 256;
+        while ((frecency.count + 1) * 2 > frecency.slot_count)
+            frecency.slot_count *= 2;
+        frecency.slots = calloc(frecency.slot_count, sizeof(uint32_t));
+        for (uint32_t i = 0; i < frecency.count; ++i) {
+            uint32_t s = fsi_hash(frecency.entries[i].path, strlen(frecency.entries[i].path)) % frecency.slot_count;
+            while (frecency.slots[s])
+                s = (s + 1) % frecency.slot_count;
+            frecency.slots[s] = i + 1;
+        }
+    }
+
+    uint32_t s = fsi_hash(path, strlen(path)) % frecency.slot_count;
+    for (; frecency.slots[s]; s = (s + 1) % frecency.slot_count)
+        if (strcmp(frecency.entries[frecency.slots[s] - 1].path, path) == 0)
+            return &frecency.entries[frecency.slots[s] - 1];
+    if (!create)
+        return NULL;
+
+    if (frecency.count == frecency.cap) {
+        frecency.cap = frecency.cap ? frecency.cap * 2 : 256;
+        frecency.entries = realloc(frecency.entries, frecency.cap * sizeof(struct frecency_entry));
+    }
+    struct frecency_entry *e = &frecency.entries[frecency.count];
+    e->path = strdup(path);
+    e->visits = 0;
+    e->last_visit = 0;
+    frecency.slots[s] = ++frecency.count;
+    return e;
+}
+
+/**
+ * Rebuilds the map keeping only entries that are still worth something,
+ * after halving every count once the total gets too large.
+ */
+static void frecency_age()
+{
+    uint32_t kept = 0;
+    frecency.total_visits = 0;
+    for (uint32_t i = 0; i < frecency.count; ++i) {
+        struct frecency_entry e = frecency.entries[i];
+        e.visits /= 2;
+        if (e.visits == 0) {
+            free(e.path);
+            continue;
+        }
+        frecency.total_visits += e.visits;
+        frecency.entries[kept++] = e;
+    }
+    frecency.count = kept;
+    frecency.slot_count = 0; // rehash on the next lookup
+}
+
+static void frecency_add(const char *path, uint32_t visits, int64_t when)
+{
+    struct frecency_entry *e = frecency_lookup(path, true);
+    e->visits += visits;
+    if (when > e->last_visit)
+        e->last_visit = when;
+    frecency.total_visits += visits;
+    if (frecency.total_visits > FRECENCY_MAX_VISITS)
+        frecency_age();
+}
+
+static void frecency_clear()
+{
+    for (uint32_t i = 0; i < frecency.count; ++i)
+        free(frecency.entries[i].path);
+    frecency.count = 0;
+    frecency.total_visits = 0;
+    frecency.slot_count = 0;
+}
+
+/**
+ * Adds the records of a snapshot (after its magic) or of the log to the
+ * map. A torn record at the end, from a crash mid-append, is ignored.
+ * @return -1 if the file does not exist
+ */
+static int frecency_read(const char *file, bool snapshot)
+{
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    size_t start = snapshot ? 8 : 0;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > start) {
+        char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED && (!snapshot || memcmp(data, FRECENCY_MAGIC, 8) == 0)) {
+            size_t pos = start;
+            struct frecency_record r;
+            char path[PATH_MAX];
+            while (pos + sizeof(r) <= (size_t)st.st_size) {
+                memcpy(&r, data + pos, sizeof(r));
+                pos += sizeof(r);
+                if (r.path_len >= sizeof(path) || pos + r.path_len > (size_t)st.st_size)
+                    break;
+                memcpy(path, data + pos, r.path_len);
+                path[r.path_len] = 0;
+                pos += r.path_len;
+                frecency_add(path, r.visits, r.last_visit);
+            }
+        }
+        if (data != MAP_FAILED)
+            munmap(data, st.st_size);
+    }
+    close(fd);
+    return 0;
+}
+
+static int frecency_log_open()
+{
+    if (frecency.log_fd == -1)
+        frecency.log_fd = open(FRECENCY_LOG, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    return frecency.log_fd;
+}
+
+/**
+ * Folds the log into a new snapshot. Without a snapshot the map starts
+ * from the cdh history made before this session; later entries are this
+ * session's visits, which are in the log already. Leaves the map loaded
+ * with what is on disk.
+ */
+static void frecency_compact()
+{
+    int log_fd = frecency_log_open();
+    if (log_fd == -1 || flock(log_fd, LOCK_EX) == -1)
+        return;
+
+    frecency_clear();
+    if (frecency_read(FRECENCY_FILE, true) == -1) {
+        char path[PATH_MAX];
+        size_t count = history_count();
+        for (size_t i = 0; i < frecency.history_base && i < count; ++i)
+            if (history_get(i, path, sizeof(path)) == 0 && path[0])
+                frecency_add(path, 1, 0);
+    }
+    frecency_read(FRECENCY_LOG, false);
+    frecency.loaded = true;
+
+    FILE *out = fopen(FRECENCY_FILE ".tmp", "w");
+    if (out) {
+        fwrite(FRECENCY_MAGIC, 1, 8, out);
+        for (uint32_t i = 0; i < frecency.count; ++i) {
+            struct frecency_entry *e = &frecency.entries[i];
+            struct frecency_record r = {e->visits, strlen(e->path), e->last_visit};
+            fwrite(&r, sizeof(r), 1, out);
+            fwrite(e->path, 1, r.path_len, out);
+        }
+        // The log may only go once the snapshot holding it is in place
+        if (fclose(out) == 0 && rename(FRECENCY_FILE ".tmp", FRECENCY_FILE) == 0) {
+            frecency.seeded = true;
+            if (ftruncate(log_fd, 0) == -1) {
+                // left for the next rewrite, which will count it again
+            }
+        }
+    }
+    flock(log_fd, LOCK_UN);
+}
+
+/**
+ * Loads the snapshot and the log, making the snapshot first if there is
+ * none.
+ */
+static void frecency_load()
+{
+    if (frecency.loaded)
+        return;
+    if (access(FRECENCY_FILE, F_OK) != 0) {
+        frecency_compact();
+        return;
+    }
+    frecency.loaded = true;
+    int log_fd = frecency_log_open();
+    bool locked = log_fd != -1 && flock(log_fd, LOCK_SH) == 0;
+    frecency_read(FRECENCY_FILE, true);
+    frecency_read(FRECENCY_LOG, false);
+    if (locked)
+        flock(log_fd, LOCK_UN);
+}
+
+/**
+ * Remembers how much of the cdh history predates this session. Called
+ * once at startup.
+ */
+void frecency_init()
+{
+    frecency.history_base = history_count();
+}
+
+/**
+ * Records a visit to a directory by appending it to the log.
+ */
+void frecency_visit(const char *path)
+{
+    // The first visit ever makes the snapshot, so that the history it is
+    // seeded from is never counted on top of a log
+    if (!frecency.seeded) {
+        if (access(FRECENCY_FILE, F_OK) == 0)
+            frecency.seeded = true;
+        else
+            frecency_compact();
+    }
+
+    int64_t now = time(NULL);
+    char record[sizeof(struct frecency_record) + PATH_MAX];
+    struct frecency_record r = {1, strlen(path), now};
+    int log_fd = frecency_log_open();
+    if (log_fd != -1 && r.path_len < PATH_MAX) {
+        memcpy(record, &r, sizeof(r));
+        memcpy(record + sizeof(r), path, r.path_len);
+        flock(log_fd, LOCK_SH);
+        if (write(log_fd, record, sizeof(r) + r.path_len) == -1) {
+            // the visit is still counted in this session
+        }
+        flock(log_fd, LOCK_UN);
+    }
+    if (frecency.loaded)
+        frecency_add(path, 1, now);
+}
+
+/**
+ * Folds the log into the snapshot once it has grown, at exit.
+ */
+void frecency_save()
+{
+    struct stat st;
+    if (frecency.log_fd != -1 && fstat(frecency.log_fd, &st) == 0 && st.st_size > FRECENCY_COMPACT_SIZE)
+        frecency_compact();
+}
+
+/**
+ * Finds a query term in a path, ignoring case: as a substring if
+ * possible, otherwise as a subsequence ("dcs" finds "docs").
+ * @param end    set past the last matched character
+ * @param approx set if only the subsequence matched
+ * @return       where the match starts, NULL if there is none
+ */
+static const char *fuzzy_find(const char *path, const char *term, const char **end, bool *approx)
+{
+    const char *start = strcasestr(path, term);
+    if (start) {
+        *end = start + strlen(term);
+        return start;
+    }
+
+    *approx = true;
+    const char *p = path;
+    for (const char *t = term; *t; ++t, ++p) {
+        while (*p && tolower((unsigned char)*p) != tolower((unsigned char)*t))
+            p++;
+        if (!*p)
+            return NULL;
+        if (t == term)
+            start = p;
+    }
+    *end = p;
+    return start;
+}
+
+/**
+ * Scores an entry against the query terms: the terms must appear in the
+ * path in order, the score is the visit count weighted by how recent the
+ * last visit was, doubled if the last term is found in the last path
+ * component and halved for every term that only matched fuzzily.
+ * @return the score, 0 if the entry does not match
+ */
+static double frecency_score(const struct frecency_entry *e, char **terms, int term_count, time_t now)
+{
+    const char *at = e->path, *last_match = NULL;
+    int approx_count = 0;
+    for (int i = 0; i < term_count; ++i) {
+        bool approx = false;
+        last_match = fuzzy_find(at, terms[i], &at, &approx);
+        if (!last_match)
+            return 0;
+        approx_count += approx;
+    }
+
+    double score = e->visits;
+    int64_t age = now - e->last_visit;
+    if (age < 3600)
+        score *= 4;
+    else if (age < 86400)
+        score *= 2;
+    else if (age < 7 * 86400)
+        score /= 2;
+    else
+        score /= 4;
+
+    if (term_count && last_match && !strchr(last_match, '/'))
+        score *= 2;
+    while (approx_count--)
+        score /= 2;
+    return score;
+}
+
+/**
+ * z [-l] [term...]
+ * Jumps to the highest ranked directory matching all terms, or with -l
+ * (or no terms) lists the best matches.
+ */
+int z_builtin(struct command_t *command)
+{
+    bool list = false;
+    char **terms = command->args;
+    int term_count = command->arg_count;
+    if (term_count && strcmp(terms[0], "-l") == 0) {
+        list = true;
+        terms++;
+        term_count--;
+    }
+    if (term_count == 0)
+        list = true;
+
+    frecency_load();
+    time_t now = time(NULL);
+
+    if (list) {
+        // Keep the best Z_LISTED by insertion into a small sorted array
+        struct frecency_entry *best[Z_LISTED];
+        double scores[Z_LISTED];
+        int shown = 0;
+        for (uint32_t i = 0; i < frecency.count; ++i) {
+            double score = frecency_score(&frecency.entries[i], terms, term_count, now);
+            if (score <= 0 || (shown == Z_LISTED && score <= scores[shown - 1]))
+                continue;
+            int j = shown < Z_LISTED ? shown++ : Z_LISTED - 1;
+            for (; j > 0 && scores[j - 1] < score; --j) {
+                best[j] = best[j - 1];
+                scores[j] = scores[j - 1];
+            }
+            best[j] = &frecency.entries[i];
+            scores[j] = score;
+        }
+        for (int i = shown - 1; i >= 0; --i)
+            printf("%-10.1f %s\n", scores[i], best[i]->path);
+        return SUCCESS;
+    }
+
+    // Directories that are gone are dropped and the next best one is tried
+    while (1) {
+        struct frecency_entry *best = NULL;
+        double best_score = 0;
+        for (uint32_t i = 0; i < frecency.count; ++i) {
+            double score = frecency_score(&frecency.entries[i], terms, term_count, now);
+            if (score > best_score) {
+                best = &frecency.entries[i];
+                best_score = score;
+            }
+        }
+        if (!best) {
+            printf("-%s: z: no match found\n", sysname);
+            return SUCCESS;
+        }
+        char *path = strdup(best->path);
+        int r = change_directory(path);
+        if (r == 0 || errno != ENOENT) {
+            if (r != 0)
+                printf("-%s: z: %s: %s\n", sysname, path, strerror(errno));
+            free(path);
+            return SUCCESS;
+        }
+        best->visits = 0; // removed for good on the next aging pass
+        free(path);
+    }
+}
+
+int my_min(int first, int second) {
+    return ((first > second) ? second : first);
+}
+
+/*
+ * Script mode: commands come from a file or from a stdin that is not a
+ * terminal. There is no prompt and no termios handling; input is read in
+ * large blocks and split into lines inside the buffer.
+ */
+#define SCRIPT_BLOCK (64 * 1024)
+
+/**
+ * Runs every line read from fd as a command.
+ * @return 0, or 1 if the script could not be read
+ */
+int run_script(int fd)
+{
+    size_t cap = SCRIPT_BLOCK + 1, len = 0;
+    char *buf = malloc(cap);
+    bool eof = false;
+
+    while (!eof) {
+        if (cap - len - 1 < SCRIPT_BLOCK / 2) { // a line longer than a block
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+        ssize_t n = read(fd, buf + len, cap - len - 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            printf("-%s: %s\n", sysname, strerror(errno));
+            free(buf);
+            return 1;
+        }
+        eof = n == 0;
+        len += n;
+
+        // Run every complete line, or the unterminated last one at EOF
+        char *line = buf, *end = buf + len;
+        while (line < end) {
+            char *nl = memchr(line, '\n', end - line);
+            if (!nl && !eof)
+                break;
+            if (!nl)
+                nl = end;
+            *nl = 0;
+
+            jobs_reap();
+            struct command_t *command = arena_alloc(&command_arena, sizeof(struct command_t));
+            int code = parse_command(line, command) == 0 ? process_command(command) : SUCCESS;
+            free_command(command);
+            if (code == EXIT) {
+                free(buf);
+                return 0;
+            }
+            line = nl + 1;
+        }
+        len = line < end ? (size_t)(end - line) : 0;
+        memmove(buf, line, len);
+    }
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool interactive = argc <= 1 && isatty(STDIN_FILENO);
+    jobs_init(interactive);
+    history_open();
+    frecency_init();
+
+    if (!interactive) {
+        int fd = argc > 1 ? open(argv[1], O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        if (fd == -1) {
+            printf("-%s: %s: %s\n", sysname, argv[1], strerror(errno));
+            return 1;
+        }
+        int r = run_script(fd);
+        frecency_save();
+        return r;
+    }
+
+    while (1)
+    {
+        struct command_t *command = arena_alloc(&command_arena, sizeof(struct command_t));
+
+        int code;
+        code = prompt(command);
+        if (code == EXIT)
+            break;
+
+        code = process_command(command);
+        if (code == EXIT)
+            break;
+
+        free_command(command);
+    }
+
+    frecency_save();
+    printf("\n");
+    return 0;
+}
+
+/**
+ * Changes the working directory and records it in the cdh history.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int change_directory(const char *path)
+{
+    if (chdir(path) == -1)
+        return -1;
+    prompt_cwd_changed();
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd))) {
+        printf("\n%s\n", cwd);
+        history_add(cwd);
+        frecency_visit(cwd);
+    }
+    return 0;
+}
+
+/*
+ * Builtins. They run inside the shell without spawning anything, with
+ * their redirections applied to the shell's own descriptors for the
+ * duration. Each one returns SUCCESS or EXIT and leaves its exit status
+ * in last_status.
+ */
+
+/**
+ * exit: leaves the shell. The kernel module stays loaded for the next
+ * session; pstraverse -u removes it.
+ */
+int exit_builtin(struct command_t *command)
+{
+    (void)command;
+    return EXIT;
+}
+
+/**
+ * cd [dir]: changes directory, to $HOME without an argument.
+ */
+int cd_builtin(struct command_t *command)
+{
+    const char *path = command->arg_count > 0 ? command->args[0] : getenv("HOME");
+    if (!path) {
+        printf("-%s: %s: HOME not set\n", sysname, command->name);
+        last_status = 1;
+        return SUCCESS;
+    }
+    int r = change_directory(path);
+    if (r == -1) {
+        printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+        last_status = 1;
+    }
+    return SUCCESS;
+}
+
+/**
+ * take a/b/c: creates the directories as needed and moves into the last one.
+ */
+int take_builtin(struct command_t *command)
+{
+    int r;
+    if (command->arg_count < 1) {
+        printf("usage: take <directory>[/<directory>...]\n");
+        last_status = 2;
+        return SUCCESS;
+    }
+    printf("Creating Directories \n");
+
+    // parsing
+    char delim[] = "/";
+    char *ptr = strtok(command->args[0], delim);
+    while (ptr != NULL) {
+        // Create first directory
+        int check = mkdir(ptr, 0777);
+
+        if (!check) {
+            r = chdir(ptr);
+            if (r == -1) {
+                printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+            }
+        } else { // This most likely means that the directory already existed.
+            r = chdir(ptr);
+            if (r == -1) {
+                printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+            }
+        }
+        if (r == -1) {
+            last_status = 1;
+            break;
+        }
+        ptr = strtok(NULL, delim);
+    }
+    prompt_cwd_changed();
+    return SUCCESS;
+}
+
+/**
+ * filesearch: start searching with the proper flags.
+ */
+int filesearch_builtin(struct command_t *command)
+{
+    bool o_flag = false;
+    bool r_flag = false;
+    bool i_flag = false;
+    bool g_flag = false;
+    char *content = NULL;
+    bool usage = false;
+    char **patterns = malloc(sizeof(char *) * (command->arg_count + 1));
+    int pattern_count = 0;
+
+    for (int i = 0; i < command->arg_count; ++i) {
+        if (strcmp(command->args[i], "-o") == 0) o_flag = true;
+        else if (strcmp(command->args[i], "-r") == 0) r_flag = true;
+        else if (strcmp(command->args[i], "-i") == 0) i_flag = true;
+        else if (strcmp(command->args[i], "-g") == 0) g_flag = true;
+        else if (strcmp(command->args[i], "-c") == 0) {
+            if (i + 1 < command->arg_count)
+                content = command->args[++i];
+            else
+                usage = true; // not a pattern named "-c"
+        }
+        else if (strcmp(command->args[i], "--index") == 0) {
+            free(patterns);
+            fsindex_build();
+            return SUCCESS;
+        }
+        else patterns[pattern_count++] = command->args[i];
+    }
+
+    struct name_matcher matcher;
+    bool has_names = name_matcher_init(&matcher, patterns, pattern_count, i_flag, g_flag) == 0;
+    if (usage || (!has_names && !(content && content[0]))) {
+        printf("usage: filesearch <pattern>... [-r] [-o] [-i] [-g]\n");
+        printf("       filesearch -c <text> [<pattern>...] [-r] [-o] [-i] [-g]\n");
+        printf("       filesearch --index\n");
+        last_status = 2;
+    } else if (content && content[0]) {
+        // Names, if any were given, narrow down the files to look into
+        filesearch_helper(".", has_names ? &matcher : NULL, content, o_flag, r_flag);
+    }
+    // A recursive search for a single plain substring is answered from
+    // the index when there is one, otherwise start searching on the
+    // current folder
+    else if (!r_flag || matcher.count > 1 || i_flag || g_flag
+             || fsindex_search(matcher.patterns[0], o_flag) != 0)
+        filesearch_helper(".", &matcher, NULL, o_flag, r_flag);
+
+    name_matcher_free(&matcher);
+    free(patterns);
+    return SUCCESS;
+}
+
+/**
+ * courseprep <course>: creates the directory layout of a new course.
+ */
+int courseprep_builtin(struct command_t *command)
+{
+    int r;
+    if (command->arg_count < 1) {
+        printf("usage: courseprep <course>\n");
+        last_status = 2;
+        return SUCCESS;
+    }
+
+    // Create main course directory
+    int check = mkdir(command->args[0], 0777);
+    if (check) {
+        printf("Could not create %s directory. \n", command->args[0]);
+    }
+    // Create HW, Lecture Notes, Syllabus, Projects, PastExams
+    r = chdir(command->args[0]);
+    if (r == -1) {
+        printf("Could not cd into %s. \n", command->args[0]);
+        last_status = 1;
+        return SUCCESS;
+    }
+
+    check = mkdir("HW", 0777);
+    if (check) {
+        printf("Could not create HW directory. \n");
+    }
+
+    check = mkdir("LectureNotes", 0777);
+    if (check) {
+        printf("Could not create LectureNotes directory. \n");
+    }
+    chdir("LectureNotes");
+    FILE *fp;
+    fp = fopen("NOTE1.txt", "w");
+
+    time_t t;   // not a primitive datatype
+    time(&t);
+
+    // Create a note file with the days date
+    if (fp) {
+        fprintf(fp, "The First Note for the %s course has been taken at: %s", command->args[0], ctime(&t));
+        fclose(fp);
+    }
+    chdir("../");
+
+    check = mkdir("Projects", 0777);
+    if (check) {
+        printf("Could not create Projects directory. \n");
+    }
+
+    check = mkdir("Syllabus", 0777);
+    if (check) {
+        printf("Could not create Syllabus directory. \n");
+    }
+
+    check = mkdir("PastExams", 0777);
+    if (check) {
+        printf("Could not create PastExams directory. \n");
+    }
+
+    chdir("../");
+    prompt_cwd_changed();
+    return SUCCESS;
+}
+
+/**
+ * didemunatsays: concatenates the args and makes Didem Unat say them
+ * along with an ASCII portrait.
+ */
+int didemunatsays_builtin(struct command_t *command)
+{
+    char says[300];
+    int len = snprintf(says, sizeof(says), "\nDidem Unat says: ");
+    for (int i = 0; i < command->arg_count && len < (int)sizeof(says); ++i)
+        len += snprintf(says + len, sizeof(says) - len, "%s ", command->args[i]);
+
+    char *didem_hoca = "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!7777777!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!7JY5PGGGGGGGGP5J?7!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!!!!!!!!??!!77!?JJ5B#&&&&##&&&&&&&&##BP5YJ77!!!!!!!!!!!!!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!!!!!!!75BP555G#&&&@@@&&&&@@@&&&&&&&&&&#BBGGPY7!!!!!!!!!!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!!!!!!7?YB&&&&&@@&@@&&&&&@@@&&&&&&&&&&&&&####&G57!!!!!!!!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!!!!!7P#&&@@@&&&&@@@@@@&&&&@@&@@@@@@&&&@@@&&&&&B5?7!!!!!!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!!!!!YG&&@@@#&&@@@@@@@&@@&&&&&&###&&&@@@@@@@@&&&&#B5!!!!!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!!!7Y#&&&&&@@@@@@@@&&##PJ7777?J777?J5G#&@@@@@&&&&@@&BPJ7!!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!!!?5B&@@&&&@@&@@@&&&GPJ!~~^^^^^^^^~~~!7?5B&@@@&&&&@@@@&#BJ!!!!!!!!!!!!!\n"
+                       "!!!!!!!!!7Y5#&@@@@@@@@&@&BB#B7~^^^^::::^^^^^^^~~~!?5B&@@&@@@@@@@&B?!!!!!!!!!!!!!\n"
+                       "!!!!!!!!J5GGB&&@@&@@@@@&GPB#5~~^^::::::::^^^^^^~~!77JB&@@@@@@@@@&&#J!!!!!!!!!!!!\n"
+                       "!!!!!!7YGGGG#@@@@@@@@@@#P5Y7~~^^^:::::::::^^^^^~~!!77Y#&@@@@@@@@&@#?!!!!!!!!!!!!\n"
+                       "!!!!!5GBGPB&@@@@@@@@@@&BY7~~~^^::::::::::::^^^^^^~~!7?Y#@@@@@@@@@B7~!!!!!!!!!!!!\n"
+                       "!!!!YG5Y5B&&@@@@@@@@@&BY??J?7777!~^^::::::^^~~~~~!!!77J5&@@@@@@@@J!~~~~!!!!!!!!!\n"
+                       "!!!!P5?JY#@@@@@@@@@@@#GGBB55YJY555J7!~^^^~7?JY55P55PGGPYG@@@@@@@@@&#BG5!!!!!!!!!\n"
+                       "!!!7B5PB#&&&@@&&&@@@&&&55YYPPP55YYJPP7~^!?5YJJYY5YYYYGB#&&@@@@@@@@@@@@&Y~!!!!!!!\n"
+                       "!!!J5G@@@@@@@@@&@@@@&BGYYG#&#&&#5P55G##B@&G55PG&&&#&G5Y5#&@@@@@@@@@@&#&J~!!!!!!!\n"
+                       "!!!7?G&@@@@@@@@@&@@@@BBYJJJJJJ?7777!5B!~G#?7777?YY5P5J?PG#@@@@&&&&@@&&G!!!!!!!!!\n"
+                       "!!!!!?B#&&&@@@@@@@@@@G5PJ7!~~~~~~^~YG7^^!BY~~~~!!!!~!75BP&@@@@@@&&&@@&&P!!!!!!!!\n"
+                       "!!!!!7P&&&@@@@@@@@@@@BP5PJ7~^^^^~?P5?!^^~7557~::^^~~7YP5G&@@@&@@@&@@@@@&G!!!!!!!\n"
+                       "!!!!!!JG####&@@@@@@@&#BPYYJ????JYYJ77~::^!?JP5??????JY5P#&&&#&@@@@@@@@@&#J~!!!!!\n"
+                       "!!!!!!?5GP##@@@@@&####BG5J?!!~!7?????!^^~7??J??7!!77?Y5G#&&B&@@@&@@@@@@@#Y!!!!!!\n"
+                       "!!!!!!!!7YG&@@@@@&5JJGGG5YJ77?YJ775BBBGGGBBGJ!7?7!77JY5G#BGB@@@@#B#&&@&&#7!!!!!!\n"
+                       "!!!!!!!!!!7#@@&@@@#7??5P55J?JJ?7!!!!7J555J7!!!!7J??JYY5GG5B@@&#@&B#BB#BGJ!!!!!!!\n"
+                       "!!!!!!!!!!~J&@&&@@@&BP&#5YJ777JPBG555YJJJ5Y55GGY?77JJ?PBPB@@@&&&#GYJ?7!!~!!!!!!~\n"
+                       "!!!!!!!!!!!~!5B#&@@@&B&@#YJ?!!!7PGJ7~^^^:~~75BY7777??Y#@@@@@#GBGY7~~~~~~!!!!!!~~\n"
+                       "!!!!!!!!!!!!~~~!?5P55YP#@BYJ7!!!?JYJ?!!7!7YYY?777!7?Y#@@@@&B7~!~~!!!!!!!!!!!!~~~\n"
+                       "!!!!!!!!!!!!!!!~~~!!!!!?5BB5Y7!7!7?JJJJJJYYJ??7!!7JYB@@#PY?!~~~!!~!!!!!!!~~~~~~~\n"
+                       "!!!!!!!!!!!!!!!!!!!!!!!!7YBBG5?7!~~~~~~~~~!!!!!!?Y5#G?!~~~~~~!~~~~~~~~~~~~~~~~~~\n"
+                       "!!!!!!!!!!!!!!!!!!!!!!!~!5GBBBG5?7~~^^^^^^~~7?J5PPG5J~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
+                       "!!!!!!!!!!!!!!!!!!!!!~~?PG55GGBBGPYJ?7777?JY5PGGGBBP!~!!~!~~~~~~~~~~~~~~~~!~~~~~\n"
+                       "!!!!!!!!~~~~~~!!!!!!~!YGP5YJYPPGGBBBGGPPPGGGGGGGBBB#P7~!!!!!!!!~~~~~~~~~~~~~~~~~\n"
+                       "!!!~~~!~~~~~~~~~~!!~!5PPYJJ??J5PPGGBBBBBBBBBGGGGGPGGBGY!!~~!!!!~~~~~~~~~~~~~~~~~\n"
+                       "!!~~~~~~~~~~~!!77J~.?PP5J??7?77J5555PGGGGGGGPP55555PGGG!^7!~~~~~~~~~~~~~~~~~~~~~\n"
+                       "~~~~~~~!!!7?JYYY5J..55P5?J?7?7!!7JYYYYY55555YYYYJYJPPPP!.J5J7!~~~~~~~~~~~~~~~~~~\n"
+                       "~~!!!7?JYYYYYYYYY~ ^5555JJ?!777!!7777???J????YYJJJJPPPP~.7555Y?77!!!~~~~~~~~~~~~\n";
+
+    printf("%s\n", says);
+    printf("%s", didem_hoca);
+    return SUCCESS;
+}
+
+/**
+ * joker: installs a cron job that shows a dad joke every minute.
+ */
+int joker_builtin(struct command_t *command)
+{
+    (void)command;
+    // cron runs the line through sh, so the $(...) are expanded there
+    const char *cron = "*/1 * * * *  XDG_RUNTIME_DIR=/run/user/$(id -u) notify-send \"$(curl https://icanhazdadjoke.com/)\"\n";
+    size_t len = strlen(cron);
+
+    // The crontab is handed to crontab - through a pipe. It fits in the
+    // pipe, so it can all be written before crontab starts.
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1 || write(fds[1], cron, len) != (ssize_t)len) {
+        printf("-%s: joker: %s\n", sysname, strerror(errno));
+        last_status = 1;
+        return SUCCESS;
+    }
+    close(fds[1]);
+    char *argv[] = {"crontab", "-", NULL};
+    last_status = spawn_program(argv, fds[0], true) == 0 ? 0 : 1;
+    close(fds[0]);
+    return SUCCESS;
+}
+
+/**
+ * cdh: lists the recently visited directories and jumps to the picked one.
+ */
+int cdh_builtin(struct command_t *command)
+{
+    (void)command;
+    print_history(CDH_SHOWN);
+    return SUCCESS;
+}
+
+/**
+ * Reads everything from fd into a NUL terminated buffer.
+ * @return the buffer, NULL with errno set on error
+ */
+static char *read_all(int fd, size_t *size)
+{
+    size_t cap = 64 * 1024, len = 0;
+    char *buf = malloc(cap);
+    while (1) {
+        if (cap - len < 4096)
+            buf = realloc(buf, cap *= 2);
+        ssize_t n = read(fd, buf + len, cap - len - 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            free(buf);
+            return NULL;
+        }
+        if (n == 0)
+            break;
+        len += n;
+    }
+    buf[len] = 0;
+    *size = len;
+    return buf;
+}
+
+/*
+ * Kernel module management. my_module.ko is loaded straight from its
+ * file with finit_module() and removed with delete_module(), so there is
+ * no sh or sudo in between and the shell needs CAP_SYS_MODULE itself.
+ * Whether it is loaded is read from /sys/module each time: a module
+ * loaded by an earlier session is reused, and it stays loaded when the
+ * shell exits.
+ */
+#define MODULE_NAME "my_module"
+
+/**
+ * @return whether the module is loaded, or still initialising
+ */
+static bool module_loaded()
+{
+    char state[16];
+    return read_small_file("/sys/module/" MODULE_NAME "/initstate", state, sizeof(state)) > 0
+           && strncmp(state, "going", 5) != 0;
+}
+
+/**
+ * Finds the module file: $SHELLFYRE_MODULE, else my_module.ko next to the
+ * shell's executable, else in the current directory.
+ */
+static void module_path(char *path, size_t size)
+{
+    const char *env = getenv("SHELLFYRE_MODULE");
+    if (env && *env) {
+        snprintf(path, size, "%s", env);
+        return;
+    }
+    char exe[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (n > 0) {
+        exe[n] = 0;
+        char *slash = strrchr(exe, '/');
+        if (slash) {
+            snprintf(path, size, "%.*s/" MODULE_NAME ".ko", (int)(slash - exe), exe);
+            if (access(path, R_OK) == 0)
+                return;
+        }
+    }
+    snprintf(path, size, MODULE_NAME ".ko");
+}
+
+/**
+ * Loads the module unless it is already loaded.
+ * @return 0, or -1 after printing the error
+ */
+static int module_load(const char *who)
+{
+    if (module_loaded())
+        return 0;
+
+    char path[PATH_MAX];
+    module_path(path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        printf("-%s: %s: %s: %s\n", sysname, who, path, strerror(errno));
+        return -1;
+    }
+    int r = syscall(SYS_finit_module, fd, "", 0);
+    if (r == -1 && errno == ENOSYS) {
+        // Kernels before 3.8 only take the image from memory
+        size_t size;
+        char *image = read_all(fd, &size);
+        r = image ? syscall(SYS_init_module, image, size, "") : -1;
+        free(image);
+    }
+    int err = errno;
+    close(fd);
+    if (r == -1 && err != EEXIST) {
+        printf("-%s: %s: loading %s: %s\n", sysname, who, path, strerror(err));
+        return -1;
+    }
+    if (r == 0)
+        printf("Module has been loaded.\n");
+    return 0;
+}
+
+/**
+ * Removes the module. Fails rather than waits while it is in use.
+ * @return 0, or -1 after printing the error
+ */
+static int module_unload(const char *who)
+{
+    if (syscall(SYS_delete_module, MODULE_NAME, O_NONBLOCK) == -1) {
+        printf("-%s: %s: unloading %s: %s\n", sysname, who, MODULE_NAME,
+               errno == EWOULDBLOCK ? "module is in use" : strerror(errno));
+        return -1;
+    }
+    printf("Module has been removed.\n");
+    return 0;
+}
+
+/*
+ * pstraverse rendering. The module lists the tasks in traversal order
+ * with their depth; a DFS listing is drawn as a tree, a BFS one level
+ * by level.
+ */
+struct pst_task
+{
+    int depth;
+    pid_t pid, ppid;
+    const char *comm;
+};
+
+static void pst_print_tree(struct pst_task *tasks, int count, int max_depth)
+{
+    // A task is the last child of its parent when no sibling follows it
+    // before the walk climbs back above its depth
+    bool *last = malloc(sizeof(bool) * count);
+    bool *later = calloc(max_depth + 2, sizeof(bool));
+    for (int i = count - 1; i >= 0; --i) {
+        int d = tasks[i].depth;
+        last[i] = !later[d];
+        later[d] = true;
+        later[d + 1] = false;
+    }
+
+    bool *open = calloc(max_depth + 1, sizeof(bool)); // ancestor has siblings left
+    for (int i = 0; i < count; ++i) {
+        int d = tasks[i].depth;
+        for (int k = 1; k < d; ++k)
+            fputs(open[k] ? "│   " : "    ", stdout);
+        if (d > 0)
+            fputs(last[i] ? "└── " : "├── ", stdout);
+        printf("%d %s\n", tasks[i].pid, tasks[i].comm);
+        open[d] = !last[i];
+    }
+    free(open);
+    free(later);
+    free(last);
+}
+
+static void pst_print_levels(struct pst_task *tasks, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        if (i == 0 || tasks[i].depth != tasks[i - 1].depth)
+            printf("level %d:\n", tasks[i].depth);
+        if (tasks[i].ppid)
+            printf("    %d %s (parent %d)\n", tasks[i].pid, tasks[i].comm, tasks[i].ppid);
+        else
+            printf("    %d %s\n", tasks[i].pid, tasks[i].comm);
+    }
+}
+
+/**
+ * Asks the module for the tree below pid and prints it.
+ * @return 0, or -1 after printing the error
+ */
+static int pst_show(pid_t pid, bool bfs)
+{
+    int fd = open(PSTRAVERSE_PATH, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        printf("-%s: pstraverse: %s: %s\n", sysname, PSTRAVERSE_PATH, strerror(errno));
+        return -1;
+    }
+    char query[32];
+    int len = snprintf(query, sizeof(query), "%d %s", pid, bfs ? "bfs" : "dfs");
+    size_t size;
+    char *text = write(fd, query, len) == len ? read_all(fd, &size) : NULL;
+    int err = errno;
+    close(fd);
+    if (!text) {
+        printf("-%s: pstraverse: %d: %s\n", sysname, pid, strerror(err));
+        return -1;
+    }
+
+    int count = 0, cap = 1024, max_depth = 0;
+    struct pst_task *tasks = malloc(sizeof(struct pst_task) * cap);
+    for (char *line = text, *nl; *line; line = nl + 1) {
+        nl = strchr(line, '\n');
+        if (!nl)
+            break;
+        *nl = 0;
+        int depth, comm_at;
+        pid_t task, parent;
+        if (sscanf(line, "%d %d %d %n", &depth, &task, &parent, &comm_at) < 3)
+            continue;
+        if (count == cap)
+            tasks = realloc(tasks, sizeof(struct pst_task) * (cap *= 2));
+        tasks[count++] = (struct pst_task){depth, task, parent, line + comm_at};
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+
+    if (bfs)
+        pst_print_levels(tasks, count);
+    else
+        pst_print_tree(tasks, count, max_depth);
+    free(tasks);
+    free(text);
+    return 0;
+}
+
+/**
+ * pstraverse [-d|-b] [pid]: loads the kernel module if needed and prints
+ * the process tree below pid (1 by default), depth first or breadth first.
+ * pstraverse -u removes the module.
+ */
+int pstraverse_builtin(struct command_t *command)
+{
+    bool bfs = false;
+    pid_t pid = 1;
+    for (int i = 0; i < command->arg_count; ++i) {
+        if (strcmp(command->args[i], "-u") == 0 && command->arg_count == 1) {
+            last_status = module_unload("pstraverse") == -1;
+            return SUCCESS;
+        }
+        if (strcmp(command->args[i], "-b") == 0)
+            bfs = true;
+        else if (strcmp(command->args[i], "-d") == 0)
+            bfs = false;
+        else if ((pid = atoi(command->args[i])) <= 0) {
+            printf("usage: pstraverse [-d|-b] [pid]\n");
+            printf("       pstraverse -u\n");
+            last_status = 2;
+            return SUCCESS;
+        }
+    }
+
+    if (module_load("pstraverse") == -1 || pst_show(pid, bfs) == -1)
+        last_status = 1;
+    return SUCCESS;
+}
+
+/**
+ * echo [-n] [-e] [args...]: prints the args. -e interprets \n, \t, \\,
+ * \a, \b, \r, \v, \e, \0nnn and \c (stop output).
+ */
+int echo_builtin(struct command_t *command)
+{
+    bool newline = true, escapes = false;
+    int i = 0;
+    for (; i < command->arg_count; ++i) {
+        const char *a = command->args[i];
+        if (a[0] != '-' || a[1] == 0 || a[strspn(a + 1, "neE") + 1] != 0)
+            break;
+        for (++a; *a; ++a) {
+            if (*a == 'n')
+                newline = false;
+            else
+                escapes = *a == 'e';
+        }
+    }
+
+    for (int first = i; i < command->arg_count; ++i) {
+        if (i > first)
+            putchar(' ');
+        const char *a = command->args[i];
+        if (!escapes) {
+            fputs(a, stdout);
+            continue;
+        }
+        for (; *a; ++a) {
+            if (*a != '\\' || !a[1]) {
+                putchar(*a);
+                continue;
+            }
+            switch (*++a) {
+            case 'n': putchar('\n'); break;
+            case 't': putchar('\t'); break;
+            case 'r': putchar('\r'); break;
+            case 'a': putchar('\a'); break;
+            case 'b': putchar('\b'); break;
+            case 'v': putchar('\v'); break;
+            case 'f': putchar('\f'); break;
+            case 'e': putchar(27); break;
+            case '\\': putchar('\\'); break;
+            case 'c': return SUCCESS; // no further output, not even the newline
+            case '0': {
+                int c = 0;
+                for (int k = 0; k < 3 && a[1] >= '0' && a[1] <= '7'; ++k)
+                    c = c * 8 + *++a - '0';
+                putchar(c);
+                break;
+            }
+            default:
+                putchar('\\');
+                putchar(*a);
+                break;
+            }
+        }
+    }
+    if (newline)
+        putchar('\n');
+    return SUCCESS;
+}
+
+/**
+ * pwd: prints the working directory, known without a system call as
+ * long as only the shell's builtins changed it.
+ */
+int pwd_builtin(struct command_t *command)
+{
+    (void)command;
+    printf("%s\n", prompt_cwd());
+    return SUCCESS;
+}
+
+int true_builtin(struct command_t *command)
+{
+    (void)command;
+    return SUCCESS;
+}
+
+int false_builtin(struct command_t *command)
+{
+    (void)command;
+    last_status = 1;
+    return SUCCESS;
+}
+
+static bool test_integer(const char *s, long *out)
+{
+    char *end;
+    errno = 0;
+    *out = strtol(s, &end, 10);
+    return errno == 0 && end != s && *end == 0;
+}
+
+/**
+ * Evaluates a test expression of at most four words.
+ * @return 0 when true, 1 when false, 2 on a malformed expression
+ */
+static int test_eval(char **a, int n)
+{
+    struct stat st, st2;
+    if (n == 0)
+        return 1;
+    if (strcmp(a[0], "!") == 0 && n > 1) {
+        int r = test_eval(a + 1, n - 1);
+        return r == 1 ? 0 : r == 0 ? 1 : 2;
+    }
+    if (n == 1)
+        return a[0][0] ? 0 : 1;
+
+    if (n == 2) {
+        const char *op = a[0], *arg = a[1];
+        if (op[0] != '-' || !op[1] || op[2])
+            return 2;
+        switch (op[1]) {
+        case 'n': return arg[0] ? 0 : 1;
+        case 'z': return arg[0] ? 1 : 0;
+        case 'e': return stat(arg, &st) == 0 ? 0 : 1;
+        case 'f': return stat(arg, &st) == 0 && S_ISREG(st.st_mode) ? 0 : 1;
+        case 'd': return stat(arg, &st) == 0 && S_ISDIR(st.st_mode) ? 0 : 1;
+        case 'p': return stat(arg, &st) == 0 && S_ISFIFO(st.st_mode) ? 0 : 1;
+        case 'S': return stat(arg, &st) == 0 && S_ISSOCK(st.st_mode) ? 0 : 1;
+        case 'b': return stat(arg, &st) == 0 && S_ISBLK(st.st_mode) ? 0 : 1;
+        case 'c': return stat(arg, &st) == 0 && S_ISCHR(st.st_mode) ? 0 : 1;
+        case 's': return stat(arg, &st) == 0 && st.st_size > 0 ? 0 : 1;
+        case 'h':
+        case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode) ? 0 : 1;
+        case 'r': return access(arg, R_OK) == 0 ? 0 : 1;
+        case 'w': return access(arg, W_OK) == 0 ? 0 : 1;
+        case 'x': return access(arg, X_OK) == 0 ? 0 : 1;
+        case 't': return isatty(atoi(arg)) ? 0 : 1;
+        }
+        return 2;
+    }
+
+    if (n == 3) {
+        const char *l = a[0], *op = a[1], *r = a[2];
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+            return strcmp(l, r) == 0 ? 0 : 1;
+        if (strcmp(op, "!=") == 0)
+            return strcmp(l, r) != 0 ? 0 : 1;
+        if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0) {
+            bool has_l = stat(l, &st) == 0, has_r = stat(r, &st2) == 0;
+            if (op[1] == 'o') // -ot is -nt with the sides swapped
+                return has_r && (!has_l || st2.st_mtim.tv_sec > st.st_mtim.tv_sec
+                                 || (st2.st_mtim.tv_sec == st.st_mtim.tv_sec
+                                     && st2.st_mtim.tv_nsec > st.st_mtim.tv_nsec)) ? 0 : 1;
+            return has_l && (!has_r || st.st_mtim.tv_sec > st2.st_mtim.tv_sec
+                             || (st.st_mtim.tv_sec == st2.st_mtim.tv_sec
+                                 && st.st_mtim.tv_nsec > st2.st_mtim.tv_nsec)) ? 0 : 1;
+        }
+
+        static const char *ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        for (int i = 0; i < 6; ++i) {
+            if (strcmp(op, ops[i]) != 0)
+                continue;
+            long x, y;
+            if (!test_integer(l, &x) || !test_integer(r, &y))
+                return 2;
+            bool result[] = {x == y, x != y, x < y, x <= y, x > y, x >= y};
+            return result[i] ? 0 : 1;
+        }
+        if (strcmp(l, "(") == 0 && strcmp(r, ")") == 0)
+            return test_eval(a + 1, 1);
+    }
+    return 2;
+}
+
+/**
+ * test expr / [ expr ]: evaluates file, string and integer tests.
+ */
+int test_builtin(struct command_t *command)
+{
+    int n = command->arg_count;
+    if (command->name[0] == '[') {
+        if (n == 0 || strcmp(command->args[n - 1], "]") != 0) {
+            printf("-%s: [: missing ']'\n", sysname);
+            last_status = 2;
+            return SUCCESS;
+        }
+        n--;
+    }
+    last_status = test_eval(command->args, n);
+    if (last_status == 2)
+        printf("-%s: %s: syntax error\n", sysname, command->name);
+    return SUCCESS;
+}
+
+/*
+ * Builtin registry. Names are looked up with a perfect hash: FNV-1a
+ * started from BUILTIN_SEED, top BUILTIN_BITS bits. The seed was
+ * searched offline so that no two names share a slot, and the table
+ * below is laid out by slot. A lookup is one hash and one strcmp.
+ * Adding a builtin means searching a new seed (or widening the table)
+ * and placing every name again.
+ */
+#define BUILTIN_BITS 5
+#define BUILTIN_SEED 0x811ca29du
+
+struct builtin
+{
+    const char *name;
+    int (*run)(struct command_t *command);
+};
+
+static const struct builtin builtins[1 << BUILTIN_BITS] = {
+    [0] = {"[", test_builtin},
+    [1] = {"mydev", mydev_builtin},
+    [2] = {"jobs", jobs_builtin},
+    [3] = {"test", test_builtin},
+    [4] = {"z", z_builtin},
+    [8] = {"fg", fg_builtin},
+    [10] = {"bg", fg_builtin},
+    [11] = {"take", take_builtin},
+    [12] = {"hash", hash_builtin},
+    [13] = {"filesearch", filesearch_builtin},
+    [14] = {"false", false_builtin},
+    [15] = {"cd", cd_builtin},
+    [17] = {"courseprep", courseprep_builtin},
+    [19] = {"pwd", pwd_builtin},
+    [21] = {"didemunatsays", didemunatsays_builtin},
+    [22] = {"pstraverse", pstraverse_builtin},
+    [23] = {"true", true_builtin},
+    [25] = {"joker", joker_builtin},
+    [26] = {"echo", echo_builtin},
+    [29] = {"exit", exit_builtin},
+    [30] = {"wait", wait_builtin},
+    [31] = {"cdh", cdh_builtin},
+};
+
+/**
+ * Finds a builtin by name.
+ * @return the builtin, NULL for anything else
+ */
+const struct builtin *builtin_lookup(const char *name)
+{
+    uint32_t h = BUILTIN_SEED;
+    for (const char *c = name; *c; ++c)
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    const struct builtin *b = &builtins[h >> (32 - BUILTIN_BITS)];
+    return b->name && strcmp(b->name, name) == 0 ? b : NULL;
+}
+
+/**
+ * Opens the <, >, >> and 2> targets of a command onto fds 0, 1 and 2 of
+ * the current process. When saved is given, the descriptors that get
+ * replaced are kept there (-1 when untouched) for builtin_restore().
+ * @return 0, or -1 after printing the error
+ */
+static int builtin_redirect(struct command_t *command, int saved[3])
+{
+    static const int flags[4] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND,
+                                 O_WRONLY | O_CREAT | O_TRUNC};
+    static const int targets[4] = {STDIN_FILENO, STDOUT_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+    fflush(stdout);
+    for (int i = 0; i < 4; ++i) {
+        if (!command->redirects[i])
+            continue;
+        int fd = open(command->redirects[i], flags[i] | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            printf("-%s: %s: %s\n", sysname, command->redirects[i], strerror(errno));
+            return -1;
+        }
+        int t = targets[i];
+        if (saved && saved[t] == -1)
+            saved[t] = fcntl(t, F_DUPFD_CLOEXEC, 10);
+        dup2(fd, t);
+        close(fd);
+    }
+    return 0;
+}
+
+static void builtin_restore(int saved[3])
+{
+    fflush(stdout);
+    for (int t = 0; t < 3; ++t) {
+        if (saved[t] != -1) {
+            dup2(saved[t], t);
+            close(saved[t]);
+        }
+    }
+}
+
+/**
+ * Runs a builtin in the shell process.
+ * @return what the builtin returned
+ */
+int builtin_run(const struct builtin *builtin, struct command_t *command)
+{
+    int saved[3] = {-1, -1, -1};
+    int code = SUCCESS;
+    if (builtin_redirect(command, saved) == 0)
+        code = builtin->run(command);
+    else
+        last_status = 1;
+    builtin_restore(saved);
+    return code;
+}
+
+/**
+ * Runs a builtin that is part of a pipeline or sent to the background in
+ * a child process, set up the same way spawn_command() sets up a program.
+ * @return pid of the child, -1 on error
+ */
+pid_t builtin_fork(const struct builtin *builtin, struct command_t *command, int in_fd, int out_fd,
+                   pid_t pgid, bool foreground)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid == -1)
+            printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+        return pid;
+    }
+
+    if (jobs.control) {
+        setpgid(0, pgid);
+        if (foreground)
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+        int job_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+        for (size_t i = 0; i < sizeof(job_signals) / sizeof(job_signals[0]); ++i)
+            signal(job_signals[i], SIG_DFL);
+    } else if (!foreground && in_fd == -1) {
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd != -1 && fd != STDIN_FILENO) {
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+        }
+    }
+    if (in_fd != -1)
+        dup2(in_fd, STDIN_FILENO);
+    if (out_fd != -1)
+        dup2(out_fd, STDOUT_FILENO);
+    if (builtin_redirect(command, NULL) == -1)
+        _exit(1);
+
+    last_status = 0;
+    builtin->run(command);
+    fflush(stdout);
+    _exit(last_status);
+}
+
+int process_command(struct command_t *command)
+{
+    if (strcmp(command->name, "") == 0)
+        return SUCCESS;
+    last_status = 0;
+
+    // A lone foreground builtin runs in the shell itself, anything else
+    // is a job
+    const struct builtin *builtin = builtin_lookup(command->name);
+    if (builtin && !command->next && !command->background)
+        return builtin_run(builtin, command);
+
+    return execute_pipeline(command);
+}
+
+/**
+ * Queues the <, >, >> and 2> redirections of a command as spawn file
+ * actions, so the files are opened in the child between fork and exec.
+ * @param actions file actions of the stage being spawned
+ * @param command the pipeline stage whose redirects are applied
+ */
+void add_redirect_actions(posix_spawn_file_actions_t *actions, struct command_t *command)
+{
+    static const int flags[4] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND,
+                                 O_WRONLY | O_CREAT | O_TRUNC};
+    static const int targets[4] = {STDIN_FILENO, STDOUT_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+    for (int i = 0; i < 4; ++i)
+        if (command->redirects[i])
+            posix_spawn_file_actions_addopen(actions, targets[i], command->redirects[i], flags[i], 0644);
+}
+
+/**
+ * Starts a single pipeline stage with posix_spawn. Everything the child
+ * needs (argv, pipe ends, redirects) is prepared here in the parent, so
+ * the child never touches the shell's heap and glibc can launch it with
+ * a vfork-style clone instead of copying the shell's page tables.
+ * @param  command    the stage to launch
+ * @param  in_fd      fd to use as stdin, -1 to inherit
+ * @param  out_fd     fd to use as stdout, -1 to inherit
+ * @param  pgid       process group to join, 0 to lead a new one
+ * @param  foreground whether the stage belongs to a foreground job
+ * @return            pid of the child, -1 on error
+ */
+pid_t spawn_command(struct command_t *command, int in_fd, int out_fd, pid_t pgid, bool foreground)
+{
+    const struct builtin *builtin = builtin_lookup(command->name);
+    if (builtin)
+        return builtin_fork(builtin, command, in_fd, out_fd, pgid, foreground);
+
+    const char *path = resolve_command(command->name);
+    if (!path) {
+        printf("-%s: %s: command not found\n", sysname, command->name);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    if (jobs.control) {
+        // Own process group, and the signals the shell ignores back to
+        // their defaults so that Ctrl+C and Ctrl+Z reach the job
+        sigset_t signals;
+        sigemptyset(&signals);
+        posix_spawnattr_setsigmask(&attr, &signals);
+        int job_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+        for (size_t i = 0; i < sizeof(job_signals) / sizeof(job_signals[0]); ++i)
+            sigaddset(&signals, job_signals[i]);
+        posix_spawnattr_setsigdefault(&attr, &signals);
+        posix_spawnattr_setpgroup(&attr, pgid);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 35)
+        // Take the terminal in the child before exec, so that it cannot
+        // read from it before the parent hands it over. Must come before
+        // stdin is replaced.
+        if (foreground)
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+    } else if (!foreground && in_fd == -1) {
+        // Background commands of a script must not eat its input
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+
+    if (in_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    if (out_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    add_redirect_actions(&actions, command);
+
+    pid_t pid;
+    int r = posix_spawn(&pid, path, &actions, &attr, command->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (r != 0) {
+        printf("-%s: %s: %s\n", sysname, command->name, strerror(r));
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * Runs a program on behalf of a builtin, without /bin/sh in between:
+ * argv[0] is looked up in PATH and every argument reaches it as is, so
+ * nothing needs quoting. A program that is not waited for gets its own
+ * process group, out of reach of the terminal's signals, and is
+ * collected by jobs_reap() like any other child.
+ * @param  argv  NULL terminated argument vector
+ * @param  in_fd fd to use as stdin, -1 for /dev/null
+ * @param  wait  whether to wait for the program to finish
+ * @return       its exit status when waited for, else its pid once
+ *               started; -1 after printing the error
+ */
+int spawn_program(char *const argv[], int in_fd, bool wait)
+{
+    const char *path = resolve_command(argv[0]);
+    if (!path) {
+        printf("-%s: %s: command not found\n", sysname, argv[0]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    if (in_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    else
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (!wait) {
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    }
+
+    fflush(stdout);
+    pid_t pid;
+    int r = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (r != 0) {
+        printf("-%s: %s: %s\n", sysname, argv[0], strerror(r));
+        return -1;
+    }
+    if (!wait)
+        return pid;
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            printf("-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * Launches every stage of a pipeline at once, connecting stdout of each
+ * stage to stdin of the next one, as one job. The job is waited for
+ * unless the command was sent to the background.
+ * @param  command head of the command->next chain
+ * @return         SUCCESS
+ */
+int execute_pipeline(struct command_t *command)
+{
+    struct job *job = job_create(command);
+    int in_fd = -1; // read end of the previous stage's pipe
+
+    fflush(stdout); // do not let children inherit unflushed output
+
+    for (struct command_t *c = command; c; c = c->next) {
+        int fds[2] = {-1, -1};
+
+        // Pipes are close-on-exec so that no stage keeps a stray
+        // write end open and blocks EOF for its readers.
+        if (c->next && pipe2(fds, O_CLOEXEC) == -1) {
+            printf("-%s: pipe: %s\n", sysname, strerror(errno));
+            break;
+        }
+
+        // A stage that fails to start is skipped, its neighbours see
+        // EOF / EPIPE once the parent closes its pipe ends below.
+        pid_t pid = spawn_command(c, in_fd, fds[1], job->pgid, !command->background);
+        if (pid != -1) {
+            job->procs[job->count].pid = pid;
+            job->procs[job->count++].state = JOB_RUNNING;
+            if (jobs.control && !job->pgid) {
+                // Also done by the parent so that the group exists
+                // before the next stage tries to join it
+                job->pgid = pid;
+                setpgid(pid, pid);
+                if (!command->background)
+                    tcsetpgrp(STDIN_FILENO, pid);
+            }
+        }
+        if (!c->next)
+            job->last_failed = pid == -1;
+
+        // The parent only keeps the read end that feeds the next stage
+        if (in_fd != -1)
+            close(in_fd);
+        if (fds[1] != -1)
+            close(fds[1]);
+        in_fd = fds[0];
+    }
+    if (in_fd != -1)
+        close(in_fd);
+
+    if (job->count == 0) {
+        last_status = 127;
+        job_free(job);
+        return SUCCESS;
+    }
+
+    // Waiting is applied in accordance with the given
+    // arguments, the status of a pipeline is that of its last stage
+    last_status = job_launch(job, command->background);
+    return SUCCESS;
+}
+
+/*
+ * PATH lookup cache. Resolved commands are kept in a hash table of
+ * name -> absolute path. An entry stays valid as long as the PATH
+ * directory it was found in keeps the same mtime, so a hit costs a
+ * single stat instead of a walk over every PATH directory.
+ */
+#define PATH_CACHE_BUCKETS 256
+
+struct path_dir
+{
+    char *path;
+    struct timespec mtime; // mtime when entries were last cached from it
+};
+
+struct path_entry
+{
+    char *name;
+    char *path;
+    int dir_index; // index into path_cache.dirs
+    unsigned hits;
+    struct path_entry *next;
+};
+
+static struct
+{
+    char *path_env; // the $PATH value the directories were split from
+    struct path_dir *dirs;
+    int dir_count;
+    struct path_entry *buckets[PATH_CACHE_BUCKETS];
+} path_cache;
+
+static unsigned path_cache_hash(const char *name)
+{
+    unsigned h = 2166136261u; // FNV-1a
+    for (; *name; ++name)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    return h % PATH_CACHE_BUCKETS;
+}
+
+static bool same_mtime(struct timespec a, struct timespec b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+/**
+ * Drops every cached entry, or only those found in one directory.
+ * @param dir_index directory whose entries are dropped, -1 for all
+ */
+void path_cache_flush(int dir_index)
+{
+    for (int i = 0; i < PATH_CACHE_BUCKETS; ++i) {
+        struct path_entry **link = &path_cache.buckets[i];
+        while (*link) {
+            struct path_entry *e = *link;
+            if (dir_index != -1 && e->dir_index != dir_index) {
+                link = &e->next;
+                continue;
+            }
+            *link = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+}
+
+/**
+ * Makes sure the cached directory list matches the current $PATH,
+ * starting over with an empty cache if it does not.
+ */
+static void path_cache_sync_dirs()
+{
+    const char *env = getenv("PATH");
+    if (!env)
+        env = "/usr/local/bin:/usr/bin:/bin";
+    if (path_cache.path_env && strcmp(path_cache.path_env, env) == 0)
+        return;
+
+    path_cache_flush(-1);
+    for (int i = 0; i < path_cache.dir_count; ++i)
+        free(path_cache.dirs[i].path);
+    free(path_cache.dirs);
+    free(path_cache.path_env);
+
+    path_cache.path_env = strdup(env);
+    path_cache.dir_count = 1;
+    for (const char *p = env; *p; ++p)
+        if (*p == ':')
+            path_cache.dir_count++;
+    path_cache.dirs = calloc(path_cache.dir_count, sizeof(struct path_dir));
+
+    const char *start = env;
+    for (int i = 0; i < path_cache.dir_count; ++i) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        // an empty PATH element means the current directory
+        path_cache.dirs[i].path = len ? strndup(start, len) : strdup(".");
+        start = end ? end + 1 : start + len;
+    }
+}
+
+/**
+ * Finds the absolute path of an executable through the PATH cache,
+ * walking $PATH on a miss.
+ * @param  name command name as typed
+ * @return      path owned by the cache (or name itself if it contains
+ *              a '/'), NULL if not found
+ */
+const char *resolve_command(const char *name)
+{
+    if (strchr(name, '/'))
+        return name;
+    if (name[0] == 0)
+        return NULL;
+
+    path_cache_sync_dirs();
+
+    unsigned bucket = path_cache_hash(name);
+    struct stat st;
+    for (struct path_entry *e = path_cache.buckets[bucket]; e; e = e->next) {
+        if (strcmp(e->name, name) != 0)
+            continue;
+        struct path_dir *dir = &path_cache.dirs[e->dir_index];
+        if (stat(dir->path, &st) == 0 && same_mtime(st.st_mtim, dir->mtime)) {
+            e->hits++;
+            return e->path;
+        }
+        // The directory changed since we looked, forget what came from it
+        path_cache_flush(e->dir_index);
+        break;
+    }
+
+    char candidate[PATH_MAX];
+    for (int i = 0; i < path_cache.dir_count; ++i) {
+        struct path_dir *dir = &path_cache.dirs[i];
+        if (snprintf(candidate, sizeof(candidate), "%s/%s", dir->path, name) >= (int)sizeof(candidate))
+            continue;
+        if (stat(candidate, &st) != 0 || !S_ISREG(st.st_mode) || access(candidate, X_OK) != 0)
+            continue;
+
+        // Entries cached from this directory under an older mtime may be
+        // gone by now; they must not pass the check with the new one
+        struct stat dir_st;
+        if (stat(dir->path, &dir_st) != 0)
+            dir_st.st_mtim = (struct timespec){0, 0};
+        if (!same_mtime(dir_st.st_mtim, dir->mtime)) {
+            path_cache_flush(i);
+            dir->mtime = dir_st.st_mtim;
+        }
+
+        struct path_entry *e = malloc(sizeof(struct path_entry));
+        char *e_name = strdup(name), *e_path = strdup(candidate);
+        if (!e || !e_name || !e_path) {
+            // Still found, just not cached
+            static char uncached[PATH_MAX];
+            free(e);
+            free(e_name);
+            free(e_path);
+            strcpy(uncached, candidate);
+            return uncached;
+        }
+        e->name = e_name;
+        e->path = e_path;
+        e->dir_index = i;
+        e->hits = 1;
+        e->next = path_cache.buckets[bucket];
+        path_cache.buckets[bucket] = e;
+        return e->path;
+    }
+    return NULL;
+}
+
+/**
+ * hash [-r] [name...]
+ * Without arguments lists the cached commands, -r empties the cache and
+ * names are looked up and remembered.
+ */
+int hash_builtin(struct command_t *command)
+{
+    if (command->arg_count == 0) {
+        bool empty = true;
+        for (int i = 0; i < PATH_CACHE_BUCKETS; ++i)
+            for (struct path_entry *e = path_cache.buckets[i]; e; e = e->next) {
+                if (empty)
+                    printf("hits\tcommand\n");
+                empty = false;
+                printf("%4u\t%s\n", e->hits, e->path);
+            }
+        if (empty)
+            printf("%s: hash table empty\n", sysname);
+        return SUCCESS;
+    }
+
+    for (int i = 0; i < command->arg_count; ++i) {
+        if (strcmp(command->args[i], "-r") == 0) {
+            path_cache_flush(-1);
+            continue;
         }
+        if (!resolve_command(command->args[i]))
+            printf("-%s: hash: %s: not found\n", sysname, command->args[i]);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Tab completion. Command names come from a prefix trie holding every
+ * executable on $PATH and every builtin; it is rebuilt only when $PATH or
+ * the mtime of one of its directories changes. Other words complete from
+ * directory listings read with getdents64, kept sorted per directory and
+ * dropped when the directory's mtime changes. A Tab is then two binary
+ * searches, so even a directory of 100k entries completes instantly once
+ * it has been listed.
+ */
+#define COMPLETE_DIRS 8       // directory listings kept
+#define COMPLETE_LIST_MAX 200 // candidates shown at most
+
+struct dir_item
+{
+    const char *name;
+    unsigned char type; // d_type
+};
 
-        // Start searching on the current folder
-        filesearch_helper(".", command->args[0], o_flag, r_flag);
+struct dir_index
+{
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime; // taken before listing, a later change forces a reload
+    int count;
+    struct dir_item *items; // sorted by name
+    char *strings;
+    unsigned long used;     // for eviction
+};
+
+static struct
+{
+    struct dir_index *dirs[COMPLETE_DIRS];
+    unsigned long clock;
+} dir_indexes;
+
+static int dir_item_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct dir_item *)a)->name, ((const struct dir_item *)b)->name);
+}
+
+static void dir_index_free(struct dir_index *d)
+{
+    if (!d)
+        return;
+    free(d->path);
+    free(d->items);
+    free(d->strings);
+    free(d);
+}
 
+/**
+ * Lists a directory into a sorted index.
+ * @return the index, NULL if the directory cannot be read
+ */
+static struct dir_index *dir_index_load(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1)
+            close(fd);
+        return NULL;
     }
 
-    if (strcmp(command->name, "courseprep") == 0) {
+    struct dir_index *d = calloc(1, sizeof(struct dir_index));
+    d->path = strdup(path);
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    d->mtime = st.st_mtim;
 
-        // Create main course directory
-        int check = mkdir(command->args[0], 0777);
-        if (check) {
-            printf("Could not create %s directory. \n", command->args[0]);
-        }
-        // Create HW, Lecture Notes, Syllabus, Projects, PastExams
-        r = chdir(command->args[0]);
-        if (r == -1) {
-            printf("Could not cd into %s. \n", command->args[0]);
-        }
+    size_t strings_len = 0, strings_cap = 4096;
+    int cap = 64;
+    size_t *offsets = malloc(sizeof(size_t) * cap);
+    unsigned char *types = malloc(cap);
+    d->strings = malloc(strings_cap);
 
-        check = mkdir("HW", 0777);
-        if (check) {
-            printf("Could not create HW directory. \n");
-        }
+    char *dents = malloc(FS_DENTS_BUF);
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, dents, FS_DENTS_BUF)) > 0) {
+        for (long pos = 0; pos < n;) {
+            struct linux_dirent64 *e = (struct linux_dirent64 *)(dents + pos);
+            pos += e->d_reclen;
 
-        check = mkdir("LectureNotes", 0777);
-        if (check) {
-            printf("Could not create LectureNotes directory. \n");
+            const char *name = e->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+                continue;
+            size_t len = strlen(name) + 1;
+            if (strings_len + len > strings_cap) {
+                while (strings_len + len > strings_cap)
+                    strings_cap *= 2;
+                d->strings = realloc(d->strings, strings_cap);
+            }
+            if (d->count == cap) {
+                cap *= 2;
+                offsets = realloc(offsets, sizeof(size_t) * cap);
+                types = realloc(types, cap);
+            }
+            memcpy(d->strings + strings_len, name, len);
+            offsets[d->count] = strings_len;
+            types[d->count++] = e->d_type;
+            strings_len += len;
         }
-        chdir("LectureNotes");
-        FILE *fp;
-        fp = fopen("NOTE1.txt", "w");
+    }
+    free(dents);
+    close(fd);
 
-        time_t t;   // not a primitive datatype
-        time(&t);
+    // Names move while the string block grows, point at them only now
+    d->items = malloc(sizeof(struct dir_item) * (d->count ? d->count : 1));
+    for (int i = 0; i < d->count; ++i) {
+        d->items[i].name = d->strings + offsets[i];
+        d->items[i].type = types[i];
+    }
+    free(offsets);
+    free(types);
+    qsort(d->items, d->count, sizeof(struct dir_item), dir_item_compare);
+    return d;
+}
 
-        // Create a note file with the days date
-        fprintf(fp, "The First Note for the %s course has been taken at: %s", command->args[0], ctime(&t));
-        fclose(fp);
-        chdir("../");
+/**
+ * Returns the cached listing of a directory, listing it again if it
+ * changed since.
+ * @return the index, owned by the cache, NULL if unreadable
+ */
+static struct dir_index *dir_index_get(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+        return NULL;
 
-        check = mkdir("Projects", 0777);
-        if (check) {
-            printf("Could not create Projects directory. \n");
+    int slot = 0;
+    for (int i = 0; i < COMPLETE_DIRS; ++i) {
+        struct dir_index *d = dir_indexes.dirs[i];
+        if (d && d->dev == st.st_dev && d->ino == st.st_ino) {
+            slot = i;
+            break;
         }
+        // Otherwise replace an empty slot or the least recently used one
+        if (!d || (dir_indexes.dirs[slot] && d->used < dir_indexes.dirs[slot]->used))
+            slot = i;
+    }
 
-        check = mkdir("Syllabus", 0777);
-        if (check) {
-            printf("Could not create Syllabus directory. \n");
-        }
+    struct dir_index *d = dir_indexes.dirs[slot];
+    if (!d || d->dev != st.st_dev || d->ino != st.st_ino || !same_mtime(d->mtime, st.st_mtim)) {
+        dir_index_free(d);
+        d = dir_indexes.dirs[slot] = dir_index_load(path);
+        if (!d)
+            return NULL;
+    }
+    d->used = ++dir_indexes.clock;
+    return d;
+}
 
-        check = mkdir("PastExams", 0777);
-        if (check) {
-            printf("Could not create PastExams directory. \n");
-        }
+/**
+ * Index of the first name not less than key, or past the names starting
+ * with key when past is set.
+ */
+static int dir_index_bound(const struct dir_index *d, const char *key, bool past)
+{
+    size_t key_len = strlen(key);
+    int lo = 0, hi = d->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int c = past ? strncmp(d->items[mid].name, key, key_len) : strcmp(d->items[mid].name, key);
+        if (c < 0 || (past && c == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Command name trie. Nodes live in one array; children of a node are a
+ * sibling list sorted by character.
+ */
+struct trie_node
+{
+    uint32_t child;   // 0 for none, the root is never a child
+    uint32_t sibling; // 0 for none
+    char c;
+    bool word;        // a name ends here
+};
+
+static struct
+{
+    struct trie_node *nodes;
+    uint32_t count, cap;
+    char *path_env;          // $PATH the trie was built from
+    struct timespec *mtimes; // of every $PATH directory, when built
+    int dir_count;
+} command_trie;
+
+static uint32_t trie_child(uint32_t node, char c, bool create)
+{
+    uint32_t *link = &command_trie.nodes[node].child;
+    while (*link && command_trie.nodes[*link].c < c)
+        link = &command_trie.nodes[*link].sibling;
+    if (*link && command_trie.nodes[*link].c == c)
+        return *link;
+    if (!create)
+        return 0;
+
+    if (command_trie.count == command_trie.cap) {
+        // link points into the array that is about to move
+        size_t link_off = (char *)link - (char *)command_trie.nodes;
+        command_trie.cap *= 2;
+        command_trie.nodes = realloc(command_trie.nodes, sizeof(struct trie_node) * command_trie.cap);
+        link = (uint32_t *)((char *)command_trie.nodes + link_off);
+    }
+    uint32_t n = command_trie.count++;
+    command_trie.nodes[n] = (struct trie_node){.child = 0, .sibling = *link, .c = c, .word = false};
+    *link = n;
+    return n;
+}
+
+static void trie_insert(const char *name)
+{
+    uint32_t node = 0;
+    for (; *name; ++name)
+        node = trie_child(node, *name, true);
+    command_trie.nodes[node].word = true;
+}
+
+/**
+ * Rebuilds the trie if $PATH or any of its directories changed.
+ */
+static void command_trie_sync()
+{
+    path_cache_sync_dirs();
 
-        chdir("../");
+    bool stale = !command_trie.nodes || strcmp(command_trie.path_env, path_cache.path_env) != 0;
+    struct timespec *mtimes = calloc(path_cache.dir_count, sizeof(struct timespec));
+    for (int i = 0; i < path_cache.dir_count; ++i) {
+        struct stat st;
+        if (stat(path_cache.dirs[i].path, &st) == 0)
+            mtimes[i] = st.st_mtim;
+        if (!stale && !same_mtime(mtimes[i], command_trie.mtimes[i]))
+            stale = true;
+    }
+    if (!stale) {
+        free(mtimes);
+        return;
+    }
 
+    free(command_trie.path_env);
+    free(command_trie.mtimes);
+    command_trie.path_env = strdup(path_cache.path_env);
+    command_trie.mtimes = mtimes;
+    command_trie.dir_count = path_cache.dir_count;
+    if (!command_trie.nodes) {
+        command_trie.cap = 4096;
+        command_trie.nodes = malloc(sizeof(struct trie_node) * command_trie.cap);
     }
+    command_trie.count = 1;
+    command_trie.nodes[0] = (struct trie_node){0};
+
+    for (int i = 0; i < (1 << BUILTIN_BITS); ++i)
+        if (builtins[i].name)
+            trie_insert(builtins[i].name);
 
-    // Concatenate the args and makes Didem Unat say them along
-    // with an ASCII portrait.
-    if (strcmp(command->name, "didemunatsays") == 0) {
-        char says[300];
-        strcpy(says, "\nDidem Unat says: ");
-        for (int i = 0; i < command->arg_count; ++i) {
-            strcat(says, command->args[i]);
-            strcat(says, " ");
+    for (int i = 0; i < path_cache.dir_count; ++i) {
+        // PATH directories are read once here, not kept in the listing cache
+        struct dir_index *d = dir_index_load(path_cache.dirs[i].path);
+        if (!d)
+            continue;
+        int dir_fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        for (int j = 0; j < d->count && dir_fd != -1; ++j) {
+            unsigned char type = d->items[j].type;
+            if (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN)
+                continue;
+            struct stat st;
+            if (fstatat(dir_fd, d->items[j].name, &st, 0) == 0 && S_ISREG(st.st_mode)
+                && faccessat(dir_fd, d->items[j].name, X_OK, 0) == 0)
+                trie_insert(d->items[j].name);
         }
+        if (dir_fd != -1)
+            close(dir_fd);
+        dir_index_free(d);
+    }
+}
+
+/*
+ * Candidates of one completion: how many there are, the longest prefix
+ * they share and, when they are to be listed, the first few of them.
+ */
+struct completion
+{
+    int count;
+    char common[PATH_MAX];
+    bool single_dir; // the only candidate is a directory
+    bool listing;
+    int listed;
+    char *list[COMPLETE_LIST_MAX];
+};
+
+static void completion_add(struct completion *c, const char *name, bool dir)
+{
+    if (c->listing && c->listed < COMPLETE_LIST_MAX) {
+        size_t len = strlen(name);
+        char *item = malloc(len + 2);
+        memcpy(item, name, len);
+        item[len] = dir ? '/' : 0;
+        item[len + 1] = 0;
+        c->list[c->listed++] = item;
+    }
+}
+
+static void trie_collect(struct completion *c, uint32_t node, char *name, int depth)
+{
+    if (command_trie.nodes[node].word) {
+        name[depth] = 0;
+        c->count++;
+        completion_add(c, name, false);
+    }
+    if (depth >= PATH_MAX - 1)
+        return;
+    for (uint32_t child = command_trie.nodes[node].child; child; child = command_trie.nodes[child].sibling) {
+        name[depth] = command_trie.nodes[child].c;
+        trie_collect(c, child, name, depth + 1);
+    }
+}
+
+static void complete_command(struct completion *c, const char *prefix)
+{
+    command_trie_sync();
 
-        char *didem_hoca = "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!7777777!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!7JY5PGGGGGGGGP5J?7!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!!!!!!!!??!!77!?JJ5B#&&&&##&&&&&&&&##BP5YJ77!!!!!!!!!!!!!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!!!!!!!75BP555G#&&&@@@&&&&@@@&&&&&&&&&&#BBGGPY7!!!!!!!!!!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!!!!!!7?YB&&&&&@@&@@&&&&&@@@&&&&&&&&&&&&&####&G57!!!!!!!!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!!!!!7P#&&@@@&&&&@@@@@@&&&&@@&@@@@@@&&&@@@&&&&&B5?7!!!!!!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!!!!!YG&&@@@#&&@@@@@@@&@@&&&&&&###&&&@@@@@@@@&&&&#B5!!!!!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!!!7Y#&&&&&@@@@@@@@&&##PJ7777?J777?J5G#&@@@@@&&&&@@&BPJ7!!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!!!?5B&@@&&&@@&@@@&&&GPJ!~~^^^^^^^^~~~!7?5B&@@@&&&&@@@@&#BJ!!!!!!!!!!!!!\n"
-                           "!!!!!!!!!7Y5#&@@@@@@@@&@&BB#B7~^^^^::::^^^^^^^~~~!?5B&@@&@@@@@@@&B?!!!!!!!!!!!!!\n"
-                           "!!!!!!!!J5GGB&&@@&@@@@@&GPB#5~~^^::::::::^^^^^^~~!77JB&@@@@@@@@@&&#J!!!!!!!!!!!!\n"
-                           "!!!!!!7YGGGG#@@@@@@@@@@#P5Y7~~^^^:::::::::^^^^^~~!!77Y#&@@@@@@@@&@#?!!!!!!!!!!!!\n"
-                           "!!!!!5GBGPB&@@@@@@@@@@&BY7~~~^^::::::::::::^^^^^^~~!7?Y#@@@@@@@@@B7~!!!!!!!!!!!!\n"
-                           "!!!!YG5Y5B&&@@@@@@@@@&BY??J?7777!~^^::::::^^~~~~~!!!77J5&@@@@@@@@J!~~~~!!!!!!!!!\n"
-                           "!!!!P5?JY#@@@@@@@@@@@#GGBB55YJY555J7!~^^^~7?JY55P55PGGPYG@@@@@@@@@&#BG5!!!!!!!!!\n"
-                           "!!!7B5PB#&&&@@&&&@@@&&&55YYPPP55YYJPP7~^!?5YJJYY5YYYYGB#&&@@@@@@@@@@@@&Y~!!!!!!!\n"
-                           "!!!J5G@@@@@@@@@&@@@@&BGYYG#&#&&#5P55G##B@&G55PG&&&#&G5Y5#&@@@@@@@@@@&#&J~!!!!!!!\n"
-                           "!!!7?G&@@@@@@@@@&@@@@BBYJJJJJJ?7777!5B!~G#?7777?YY5P5J?PG#@@@@&&&&@@&&G!!!!!!!!!\n"
-                           "!!!!!?B#&&&@@@@@@@@@@G5PJ7!~~~~~~^~YG7^^!BY~~~~!!!!~!75BP&@@@@@@&&&@@&&P!!!!!!!!\n"
-                           "!!!!!7P&&&@@@@@@@@@@@BP5PJ7~^^^^~?P5?!^^~7557~::^^~~7YP5G&@@@&@@@&@@@@@&G!!!!!!!\n"
-                           "!!!!!!JG####&@@@@@@@&#BPYYJ????JYYJ77~::^!?JP5??????JY5P#&&&#&@@@@@@@@@&#J~!!!!!\n"
-                           "!!!!!!?5GP##@@@@@&####BG5J?!!~!7?????!^^~7??J??7!!77?Y5G#&&B&@@@&@@@@@@@#Y!!!!!!\n"
-                           "!!!!!!!!7YG&@@@@@&5JJGGG5YJ77?YJ775BBBGGGBBGJ!7?7!77JY5G#BGB@@@@#B#&&@&&#7!!!!!!\n"
-                           "!!!!!!!!!!7#@@&@@@#7??5P55J?JJ?7!!!!7J555J7!!!!7J??JYY5GG5B@@&#@&B#BB#BGJ!!!!!!!\n"
-                           "!!!!!!!!!!~J&@&&@@@&BP&#5YJ777JPBG555YJJJ5Y55GGY?77JJ?PBPB@@@&&&#GYJ?7!!~!!!!!!~\n"
-                           "!!!!!!!!!!!~!5B#&@@@&B&@#YJ?!!!7PGJ7~^^^:~~75BY7777??Y#@@@@@#GBGY7~~~~~~!!!!!!~~\n"
-                           "!!!!!!!!!!!!~~~!?5P55YP#@BYJ7!!!?JYJ?!!7!7YYY?777!7?Y#@@@@&B7~!~~!!!!!!!!!!!!~~~\n"
-                           "!!!!!!!!!!!!!!!~~~!!!!!?5BB5Y7!7!7?JJJJJJYYJ??7!!7JYB@@#PY?!~~~!!~!!!!!!!~~~~~~~\n"
-                           "!!!!!!!!!!!!!!!!!!!!!!!!7YBBG5?7!~~~~~~~~~!!!!!!?Y5#G?!~~~~~~!~~~~~~~~~~~~~~~~~~\n"
-                           "!!!!!!!!!!!!!!!!!!!!!!!~!5GBBBG5?7~~^^^^^^~~7?J5PPG5J~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"
-                           "!!!!!!!!!!!!!!!!!!!!!~~?PG55GGBBGPYJ?7777?JY5PGGGBBP!~!!~!~~~~~~~~~~~~~~~~!~~~~~\n"
-                           "!!!!!!!!~~~~~~!!!!!!~!YGP5YJYPPGGBBBGGPPPGGGGGGGBBB#P7~!!!!!!!!~~~~~~~~~~~~~~~~~\n"
-                           "!!!~~~!~~~~~~~~~~!!~!5PPYJJ??J5PPGGBBBBBBBBBGGGGGPGGBGY!!~~!!!!~~~~~~~~~~~~~~~~~\n"
-                           "!!~~~~~~~~~~~!!77J~.?PP5J??7?77J5555PGGGGGGGPP55555PGGG!^7!~~~~~~~~~~~~~~~~~~~~~\n"
-                           "~~~~~~~!!!7?JYYY5J..55P5?J?7?7!!7JYYYYY55555YYYYJYJPPPP!.J5J7!~~~~~~~~~~~~~~~~~~\n"
-                           "~~!!!7?JYYYYYYYYY~ ^5555JJ?!777!!7777???J????YYJJJJPPPP~.7555Y?77!!!~~~~~~~~~~~~\n";
+    uint32_t node = 0;
+    for (const char *p = prefix; *p && (node || p == prefix); ++p)
+        node = trie_child(node, *p, false);
+    if (prefix[0] && !node)
+        return;
 
-        printf("%s\n", says);
-        printf("%s", didem_hoca);
+    // Longest common prefix: follow the path while it does not branch
+    size_t len = strlen(prefix);
+    memcpy(c->common, prefix, len + 1);
+    for (uint32_t n = node; !command_trie.nodes[n].word && len < sizeof(c->common) - 1;) {
+        uint32_t child = command_trie.nodes[n].child;
+        if (!child || command_trie.nodes[child].sibling)
+            break;
+        c->common[len++] = command_trie.nodes[child].c;
+        c->common[len] = 0;
+        n = child;
     }
 
-    if (strcmp(command->name, "joker") == 0) {
+    char name[PATH_MAX];
+    size_t prefix_len = strlen(prefix);
+    memcpy(name, prefix, prefix_len);
+    trie_collect(c, node, name, prefix_len);
+}
+
+static bool dir_item_is_dir(const char *dir, const struct dir_item *item)
+{
+    if (item->type == DT_DIR)
+        return true;
+    if (item->type != DT_LNK && item->type != DT_UNKNOWN)
+        return false;
+    char path[PATH_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, item->name);
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
 
-        // create cronjob file and fill it with time schedule
-        char cron[300]; // create crontab directory file
-        strcpy(cron, "*/1 * * * *  XDG_RUNTIME_DIR=/run/user/$(id -u) notify-send \"$(curl https://icanhazdadjoke.com/)\"");
+static void complete_file(struct completion *c, const char *word)
+{
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    size_t dir_len = slash ? (size_t)(slash - word + 1) : 0;
 
-        // create file path to add cronjob list.
-        char filepath[50];
-        strcpy(filepath, "/home/mycronfile.txt");
-        FILE *job_file = fopen(filepath, "w");
+    char dir[PATH_MAX];
+    const char *home = getenv("HOME");
+    if (dir_len == 0)
+        strcpy(dir, ".");
+    else if (word[0] == '~' && word[1] == '/' && home)
+        snprintf(dir, sizeof(dir), "%s%.*s", home, (int)dir_len - 1, word + 1);
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)dir_len, word);
 
-        fprintf(job_file, "%s\n", cron);
-        fclose(job_file);
+    struct dir_index *d = dir_index_get(dir);
+    if (!d)
+        return;
 
-        system("crontab /home/mycronfile.txt");
+    // Dot files only complete when asked for, they sit together in the
+    // sorted listing and [hidden_lo, hidden_hi) is their part of [lo, hi)
+    int lo = dir_index_bound(d, base, false), hi = dir_index_bound(d, base, true);
+    int hidden_lo = lo, hidden_hi = lo;
+    if (base[0] != '.') {
+        int dot_lo = dir_index_bound(d, ".", false), dot_hi = dir_index_bound(d, ".", true);
+        hidden_lo = dot_lo > lo ? dot_lo : lo;
+        hidden_hi = dot_hi < hi ? dot_hi : hi;
+        if (hidden_hi < hidden_lo)
+            hidden_hi = hidden_lo;
     }
+    c->count = (hi - lo) - (hidden_hi - hidden_lo);
+    if (c->count == 0)
+        return;
+    int first = hidden_lo == lo ? hidden_hi : lo;
+    int last = hidden_hi == hi ? hidden_lo - 1 : hi - 1;
 
+    // The names are sorted, so the first and last share what they all share
+    const char *a = d->items[first].name, *b = d->items[last].name;
+    size_t common = 0;
+    while (a[common] && a[common] == b[common])
+        common++;
+    snprintf(c->common, sizeof(c->common), "%.*s%.*s", (int)dir_len, word, (int)common, a);
+    if (c->count == 1)
+        c->single_dir = dir_item_is_dir(dir, &d->items[first]);
 
-    if (strcmp(command->name, "cdh") == 0) {
-        char *c;
-        int ctr = 1;
+    for (int i = lo; c->listing && i < hi && c->listed < COMPLETE_LIST_MAX; ++i)
+        if (i < hidden_lo || i >= hidden_hi)
+            completion_add(c, d->items[i].name, dir_item_is_dir(dir, &d->items[i]));
+}
 
-        FILE *fptr = fopen("/home/cdh_history.txt", "r");
+static void completion_print(struct completion *c, int cols)
+{
+    int width = 0;
+    for (int i = 0; i < c->listed; ++i)
+        if ((int)strlen(c->list[i]) > width)
+            width = strlen(c->list[i]);
+    width += 2;
+    int per_line = cols / width > 0 ? cols / width : 1;
+    int lines = (c->listed + per_line - 1) / per_line;
 
+    printf("\n");
+    for (int l = 0; l < lines; ++l) {
+        for (int i = l; i < c->listed; i += lines)
+            printf("%-*s", i + lines < c->listed ? width : 0, c->list[i]);
+        printf("\n");
+    }
+    if (c->count > c->listed)
+        printf("... and %d more\n", c->count - c->listed);
+    fflush(stdout);
+}
 
-        // By counting the new line characters, get the line count in the file
-        for (c = getc(fptr); c != EOF; c = getc(fptr))
-            if (c == '\n') // Increment count if this character is newline
-                ctr = ctr + 1;
-        fclose(fptr);
-        printf(" The lines in the file are : %d \n \n", ctr);
-
-        // If there are no files inside the list, issue a warning
-        if (!ctr) {
-            printf("\n\nWARNING! Not enough directories in the history.\n\n");
-        } else {
-            fptr = fopen("/home/cdh_history.txt", "r");
-            print_history(fptr, my_min(ctr, 10));
+/**
+ * Completes the word that ends at the cursor: a command name in command
+ * position, a file name anywhere else or when it contains a '/'.
+ * @param  line   the line being edited, only line[0..cursor) is looked at
+ * @param  cursor position of the cursor
+ * @param  insert filled with the text to insert at the cursor
+ * @param  cols   terminal width to list the candidates with, 0 for no list
+ * @return        number of candidates
+ */
+int complete_word(const char *line, int cursor, char *insert, size_t size, int cols)
+{
+    insert[0] = 0;
+
+    // Find where the word starts, skipping quoted and escaped separators,
+    // and whether it is the first word of its pipeline stage
+    int start = 0, words = 0;
+    bool redirect = false; // the word is the target of < or >
+    char quote = 0;
+    for (int i = 0; i < cursor; ++i) {
+        char ch = line[i];
+        if (quote) {
+            if (ch == quote)
+                quote = 0;
+            else if (ch == '\\' && quote == '"')
+                i++;
+            continue;
+        }
+        if (ch == '\\') {
+            i++;
+        } else if (ch == '\'' || ch == '"') {
+            quote = ch;
+        } else if (strchr(" \t|&<>", ch)) {
+            if (i > start) {
+                words += !redirect;
+                redirect = false;
+            }
+            if (ch == '|' || ch == '&')
+                words = 0;
+            if (ch == '<' || ch == '>')
+                redirect = true;
+            start = i + 1;
+        }
+    }
+    bool command_position = words == 0 && !redirect;
+
+    // The word as the lexer will see it: no quotes, no escapes
+    char word[PATH_MAX];
+    size_t len = 0;
+    quote = 0;
+    for (int i = start; i < cursor && len < sizeof(word) - 1; ++i) {
+        char ch = line[i];
+        if (quote ? ch == quote : ch == '\'' || ch == '"') {
+            quote = quote ? 0 : ch;
+            continue;
         }
+        if (ch == '\\' && quote != '\'' && i + 1 < cursor)
+            ch = line[++i];
+        word[len++] = ch;
     }
+    word[len] = 0;
+
+    struct completion c = {.listing = cols > 0};
+    if (command_position && !strchr(word, '/'))
+        complete_command(&c, word);
+    else
+        complete_file(&c, word);
 
+    if (c.listing && c.count > 1)
+        completion_print(&c, cols);
+    for (int i = 0; i < c.listed; ++i)
+        free(c.list[i]);
+    if (c.count == 0)
+        return 0;
 
-    if (strcmp(command->name, "pstraverse") == 0)
-    {
-        if (!loaded)
-        {
-            system("sudo insmod my_module.ko");
-            printf("Module has been loaded.\n");
-            loaded = 1;
+    // Insert the rest of the common prefix, escaped unless inside quotes
+    size_t out = 0;
+    for (const char *p = c.common + len; *p && out + 3 < size; ++p) {
+        if (!quote && strchr(" \t'\"\\|&<>#", *p))
+            insert[out++] = '\\';
+        insert[out++] = *p;
+    }
+    if (c.count == 1 && out + 2 < size) {
+        if (c.single_dir)
+            insert[out++] = '/';
+        else {
+            if (quote)
+                insert[out++] = quote;
+            insert[out++] = ' ';
+        }
+    }
+    insert[out] = 0;
+    return c.count;
+}
+
+/*
+ * mydev: talks to /dev/my_device through its shared mapping. Bytes are
+ * copied straight into or out of the driver's buffer and only the ring
+ * offsets cross the user/kernel boundary, one ioctl per transfer.
+ */
+#define MYDEV_BENCH_IOV 8
+
+static struct
+{
+    int fd;
+    char *map;
+} mydev = {-1, NULL};
+
+/**
+ * Opens and maps the device on first use.
+ * @return 0, or -1 after printing the error
+ */
+static int mydev_open()
+{
+    if (mydev.map)
+        return 0;
+    mydev.fd = open(MY_DEVICE_PATH, O_RDWR | O_CLOEXEC);
+    if (mydev.fd == -1) {
+        printf("-%s: mydev: %s: %s\n", sysname, MY_DEVICE_PATH, strerror(errno));
+        return -1;
+    }
+    void *map = mmap(NULL, MY_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mydev.fd, 0);
+    if (map == MAP_FAILED) {
+        printf("-%s: mydev: mmap: %s\n", sysname, strerror(errno));
+        close(mydev.fd);
+        mydev.fd = -1;
+        return -1;
+    }
+    mydev.map = map;
+    return 0;
+}
+
+/**
+ * Appends bytes to the ring through the mapping and publishes them.
+ * @return 0, or -1 with errno set (ENOSPC when the consumer is behind)
+ */
+static int mydev_produce(const char *data, size_t len)
+{
+    struct my_offsets o;
+    if (ioctl(mydev.fd, MY_IOC_GET_OFFSETS, &o) == -1)
+        return -1;
+    if (len > MY_BUF_SIZE - (o.tail - o.head)) {
+        errno = ENOSPC;
+        return -1;
+    }
+    size_t at = o.tail % MY_BUF_SIZE, first = len < MY_BUF_SIZE - at ? len : MY_BUF_SIZE - at;
+    memcpy(mydev.map + at, data, first);
+    memcpy(mydev.map, data + first, len - first);
+    __u64 tail = o.tail + len;
+    return ioctl(mydev.fd, MY_IOC_SET_TAIL, &tail);
+}
+
+/**
+ * Consumes everything published so far, handing it out in at most two
+ * pieces straight from the mapping.
+ * @param  out called with each piece, NULL to drop the bytes
+ * @return     bytes consumed, -1 with errno set on error
+ */
+static long mydev_consume(void (*out)(const char *data, size_t len))
+{
+    struct my_offsets o;
+    if (ioctl(mydev.fd, MY_IOC_GET_OFFSETS, &o) == -1)
+        return -1;
+    size_t len = o.tail - o.head, at = o.head % MY_BUF_SIZE;
+    size_t first = len < MY_BUF_SIZE - at ? len : MY_BUF_SIZE - at;
+    if (out && len) {
+        out(mydev.map + at, first);
+        if (len > first)
+            out(mydev.map, len - first);
+    }
+    if (ioctl(mydev.fd, MY_IOC_SET_HEAD, &o.tail) == -1)
+        return -1;
+    return len;
+}
+
+static void mydev_print(const char *data, size_t len)
+{
+    fwrite(data, 1, len, stdout);
+}
+
+static char *mydev_sink;
+
+static void mydev_copy_out(const char *data, size_t len)
+{
+    memcpy(mydev_sink, data, len);
+}
+
+static double mydev_seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * Moves total bytes through the device both ways in blocks of size.
+ * @param  how 0 for pwrite/pread, 1 for pwritev/preadv of the block in
+ *             MYDEV_BENCH_IOV pieces, 2 for the ring on the mapping
+ * @return     seconds taken, -1 with errno set on error
+ */
+static double mydev_bench_run(char *block, size_t size, size_t total, int how)
+{
+    struct iovec iov[MYDEV_BENCH_IOV];
+    for (int i = 0; i < MYDEV_BENCH_IOV; ++i) {
+        iov[i].iov_base = block + i * (size / MYDEV_BENCH_IOV);
+        iov[i].iov_len = size / MYDEV_BENCH_IOV;
+    }
+    mydev_sink = block;
+
+    double start = mydev_seconds();
+    for (size_t i = 0; i < total / size; ++i) {
+        off_t at = (i * size) % MY_MAX_SIZE;
+        bool ok;
+        errno = EIO; // left as is by a short transfer
+        if (how == 0)
+            ok = pwrite(mydev.fd, block, size, at) == (ssize_t)size
+                 && pread(mydev.fd, block, size, at) == (ssize_t)size;
+        else if (how == 1)
+            ok = pwritev(mydev.fd, iov, MYDEV_BENCH_IOV, at) == (ssize_t)size
+                 && preadv(mydev.fd, iov, MYDEV_BENCH_IOV, at) == (ssize_t)size;
+        else
+            ok = mydev_produce(block, size) != -1 && mydev_consume(mydev_copy_out) != -1;
+        if (!ok)
+            return -1;
+    }
+    return mydev_seconds() - start;
+}
+
+/**
+ * Prints the throughput of each way of moving total bytes through the
+ * device for each block size. The ring only takes blocks that fit in it.
+ */
+static void mydev_bench(size_t total)
+{
+    static const size_t sizes[] = {4 << 10, 64 << 10, 1 << 20, 16 << 20};
+    static const char *names[] = {"read/write", "readv/writev", "mmap"};
+    char *block = malloc(sizes[sizeof(sizes) / sizeof(*sizes) - 1]);
+    memset(block, 'x', sizes[sizeof(sizes) / sizeof(*sizes) - 1]);
 
-        } else{
-            printf("Module already loaded!\n");
+    printf("%zu MiB each way\n%9s", total >> 20, "block");
+    for (int how = 0; how < 3; ++how)
+        printf(" %14s", names[how]);
+    printf("\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        printf("%5zu %s", sizes[i] >> (sizes[i] < 1 << 20 ? 10 : 20), sizes[i] < 1 << 20 ? "KiB" : "MiB");
+        for (int how = 0; how < 3; ++how) {
+            if (how == 2 && sizes[i] > MY_BUF_SIZE) {
+                printf(" %14s", "-");
+                continue;
+            }
+            size_t moved = total / sizes[i] * sizes[i];
+            double seconds = mydev_bench_run(block, sizes[i], moved, how);
+            if (seconds < 0) {
+                printf("\n-%s: mydev: bench: %s: %s\n", sysname, names[how], strerror(errno));
+                free(block);
+                return;
+            }
+            printf(" %9.1f MiB/s", (moved >> 20) / seconds);
         }
+        printf("\n");
+    }
+    free(block);
+}
+
+/**
+ * Opens a second file on the device in channel mode, where read() and
+ * write() consume and produce on the ring.
+ * @return the descriptor, -1 with errno set on error
+ */
+static int mydev_open_channel(int flags)
+{
+    int fd = open(MY_DEVICE_PATH, flags | O_CLOEXEC), on = 1;
+    if (fd != -1 && ioctl(fd, MY_IOC_CHANNEL, &on) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+struct mydev_latency
+{
+    int fd;
+    int rounds;
+};
+
+/**
+ * Writes the time into the channel once a millisecond.
+ */
+static void *mydev_latency_writer(void *arg)
+{
+    struct mydev_latency *l = arg;
+    struct timespec pause = {0, 1000000};
+    for (int i = 0; i < l->rounds; ++i) {
+        nanosleep(&pause, NULL);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (write(l->fd, &now, sizeof(now)) != sizeof(now))
+            break;
+    }
+    return NULL;
+}
+
+static int mydev_compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
 
+/**
+ * Measures how long a reader waiting in poll() on the channel takes to
+ * see a write made by another thread, and prints the distribution.
+ */
+static int mydev_latency(int rounds)
+{
+    struct mydev_latency l = {-1, rounds};
+    int rfd = mydev_open_channel(O_RDONLY | O_NONBLOCK);
+    if (rfd == -1 || (l.fd = mydev_open_channel(O_WRONLY)) == -1) {
+        if (rfd != -1)
+            close(rfd);
+        return -1;
+    }
+    // Drop whatever is left in the ring so that reads line up with writes
+    struct my_offsets o;
+    if (ioctl(rfd, MY_IOC_GET_OFFSETS, &o) == 0)
+        ioctl(rfd, MY_IOC_SET_HEAD, &o.tail);
 
+    long *ns = malloc(rounds * sizeof(*ns));
+    int got = 0, r = 0;
+    pthread_t writer;
+    pthread_create(&writer, NULL, mydev_latency_writer, &l);
+    while (got < rounds) {
+        struct pollfd p = {rfd, POLLIN, 0};
+        int n = poll(&p, 1, 1000);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n != 1) {
+            if (n == 0)
+                errno = ETIMEDOUT;
+            r = -1;
+            break;
+        }
+        struct timespec sent, now;
+        if (read(rfd, &sent, sizeof(sent)) != sizeof(sent)) {
+            r = -1;
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ns[got++] = (now.tv_sec - sent.tv_sec) * 1000000000L + now.tv_nsec - sent.tv_nsec;
     }
+    int saved = errno;
+    pthread_join(writer, NULL);
+    close(l.fd);
+    close(rfd);
 
+    if (got > 0) {
+        qsort(ns, got, sizeof(*ns), mydev_compare_long);
+        printf("%d wakeups: min %.1f us, median %.1f us, p99 %.1f us, max %.1f us\n", got,
+               ns[0] / 1e3, ns[got / 2] / 1e3, ns[got * 99 / 100] / 1e3, ns[got - 1] / 1e3);
+    }
+    free(ns);
+    errno = saved;
+    return r;
+}
 
+#define MYDEV_STRESS_MAX_THREADS 64
+#define MYDEV_STRESS_MAX_IO (64 << 10)
 
-    pid_t pid = fork();
+struct mydev_stress
+{
+    int id;
+    long ops;
+    off_t stripe_off;  // the part of the device only this thread writes
+    size_t stripe_size;
+    long mismatches;
+    int err;           // errno of the first failed call
+    const char *call;  // which call it was, NULL if none failed
+};
 
-    if (pid == 0) // child
-    {
-        // increase args size by 2
-        command->args = (char **) realloc(
-                command->args, sizeof(char *) * (command->arg_count += 2));
-
-        // shift everything forward by 1
-        for (int i = command->arg_count - 2; i > 0; --i)
-            command->args[i] = command->args[i - 1];
-        // set args[0] as a copy of name
-        command->args[0] = strdup(command->name);
-        // set args[arg_count-1] (last) to NULL
-        command->args[command->arg_count - 1] = NULL;
-
-        // Execute shell commans in the bin directory
-        char command_base[20];
-        strcpy(command_base, "/bin/");
-        strcat(command_base, command->name);
-        execv(command_base, command->args);
-        exit(0);
-    } else {
+static uint64_t mydev_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
 
-        // Waiting is applied in accordance with the given
-        // arguments
-        if (command->background) {
-            return SUCCESS;
-        } else {
-            wait(NULL);
-            return SUCCESS;
+/**
+ * Runs random pread, pwrite, lseek with read or write, and reads of the
+ * whole device on a file of its own. Reads within its stripe must give
+ * back what it wrote there last.
+ */
+static void *mydev_stress_thread(void *arg)
+{
+    struct mydev_stress *t = arg;
+    char *shadow = malloc(t->stripe_size), *io = malloc(MYDEV_STRESS_MAX_IO);
+    uint64_t seed = 0x9e3779b97f4a7c15ull * (t->id + 1);
+    int fd = open(MY_DEVICE_PATH, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        t->err = errno;
+        t->call = "open";
+        goto out;
+    }
+    for (size_t i = 0; i < t->stripe_size; ++i)
+        shadow[i] = mydev_random(&seed);
+    errno = EIO; // left as is by a short transfer
+    if (pwrite(fd, shadow, t->stripe_size, t->stripe_off) != (ssize_t)t->stripe_size) {
+        t->err = errno;
+        t->call = "pwrite";
+        goto out;
+    }
+
+    for (long op = 0; op < t->ops && !t->call; ++op) {
+        uint64_t r = mydev_random(&seed);
+        size_t len = 1 + r % MYDEV_STRESS_MAX_IO % t->stripe_size;
+        size_t at = (r >> 20) % (t->stripe_size - len + 1);
+        off_t pos = t->stripe_off + at;
+        const char *failed = NULL;
+        errno = EIO;
+        switch (r >> 60 & 3) {
+        case 0:
+            for (size_t i = 0; i < len; ++i)
+                io[i] = shadow[at + i] = mydev_random(&seed);
+            if (pwrite(fd, io, len, pos) != (ssize_t)len)
+                failed = "pwrite";
+            break;
+        case 1:
+            if (pread(fd, io, len, pos) != (ssize_t)len)
+                failed = "pread";
+            else if (memcmp(io, shadow + at, len) != 0)
+                t->mismatches++;
+            break;
+        case 2:
+            // Through the file offset, reading or writing by turns
+            if (lseek(fd, pos, SEEK_SET) != pos) {
+                failed = "lseek";
+            } else if (op & 1) {
+                if (read(fd, io, len) != (ssize_t)len)
+                    failed = "read";
+                else if (memcmp(io, shadow + at, len) != 0)
+                    t->mismatches++;
+            } else {
+                for (size_t i = 0; i < len; ++i)
+                    io[i] = shadow[at + i] = mydev_random(&seed);
+                if (write(fd, io, len) != (ssize_t)len)
+                    failed = "write";
+            }
+            break;
+        default:
+            // Anywhere, racing with the other threads' writes
+            if (pread(fd, io, len, (r >> 8) % MY_MAX_SIZE) == -1)
+                failed = "pread";
+        }
+        if (failed) {
+            t->err = errno;
+            t->call = failed;
         }
+    }
+out:
+    if (fd != -1)
+        close(fd);
+    free(io);
+    free(shadow);
+    return NULL;
+}
 
+/**
+ * Opens the device from several threads at once, each mixing ops random
+ * pread, pwrite and lseek calls, and checks that no thread reads back
+ * anything but its own data from the stripe it owns. The stripes lie
+ * past the ring, which is left alone.
+ * @return 0 when nothing went wrong, -1 after printing what did
+ */
+static int mydev_stress(int threads, long ops)
+{
+    struct mydev_stress *t = calloc(threads, sizeof(*t));
+    pthread_t *ids = calloc(threads, sizeof(*ids));
+    size_t stripe = (MY_MAX_SIZE - MY_BUF_SIZE) / threads & ~(size_t)4095;
+    if (stripe > 4 << 20)
+        stripe = 4 << 20;
 
+    double start = mydev_seconds();
+    for (int i = 0; i < threads; ++i) {
+        t[i] = (struct mydev_stress){i, ops, MY_BUF_SIZE + i * stripe, stripe, 0, 0, NULL};
+        pthread_create(&ids[i], NULL, mydev_stress_thread, &t[i]);
+    }
+    long mismatches = 0;
+    int r = 0;
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(ids[i], NULL);
+        mismatches += t[i].mismatches;
+        if (t[i].call && r == 0) {
+            printf("-%s: mydev: stress: thread %d: %s: %s\n", sysname, i, t[i].call, strerror(t[i].err));
+            r = -1;
+        }
     }
+    double seconds = mydev_seconds() - start;
 
-    printf("-%s: %s: command not found\n", sysname, command->name);
-    return UNKNOWN;
+    printf("%d threads, %ld calls in %.2f s (%.0f calls/s), %ld mismatched reads\n", threads,
+           threads * ops, seconds, threads * ops / seconds, mismatches);
+    if (mismatches) {
+        printf("-%s: mydev: stress: reads returned data that was not written\n", sysname);
+        r = -1;
+    }
+    free(ids);
+    free(t);
+    return r;
 }
 
+/**
+ * mydev write <text>... | mydev read | mydev bench [MiB] | mydev latency [rounds]
+ * | mydev stress [threads] [calls]
+ */
+int mydev_builtin(struct command_t *command)
+{
+    const char *action = command->arg_count > 0 ? command->args[0] : "";
+    if (strcmp(action, "write") != 0 && strcmp(action, "read") != 0 && strcmp(action, "bench") != 0
+        && strcmp(action, "latency") != 0 && strcmp(action, "stress") != 0) {
+        printf("usage: mydev write <text>...\n");
+        printf("       mydev read\n");
+        printf("       mydev bench [MiB]\n");
+        printf("       mydev latency [rounds]\n");
+        printf("       mydev stress [threads] [calls]\n");
+        last_status = 2;
+        return SUCCESS;
+    }
+    if (mydev_open() == -1) {
+        last_status = 1;
+        return SUCCESS;
+    }
 
+    int r = 0;
+    if (strcmp(action, "write") == 0) {
+        size_t len = 0;
+        for (int i = 1; i < command->arg_count; ++i)
+            len += strlen(command->args[i]) + 1;
+        char *text = malloc(len + 1), *p = text;
+        for (int i = 1; i < command->arg_count; ++i)
+            p += sprintf(p, i > 1 ? " %s" : "%s", command->args[i]);
+        *p++ = '\n';
+        r = mydev_produce(text, p - text);
+        free(text);
+    } else if (strcmp(action, "read") == 0) {
+        r = mydev_consume(mydev_print) == -1 ? -1 : 0;
+    } else if (strcmp(action, "bench") == 0) {
+        long mib = command->arg_count > 1 ? atol(command->args[1]) : 256;
+        mydev_bench((mib > 0 ? mib : 256) << 20);
+    } else if (strcmp(action, "latency") == 0) {
+        int rounds = command->arg_count > 1 ? atoi(command->args[1]) : 1000;
+        r = mydev_latency(rounds > 0 ? rounds : 1000);
+    } else {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int threads = command->arg_count > 1 ? atoi(command->args[1]) : cpus > 1 ? cpus : 2;
+        long calls = command->arg_count > 2 ? atol(command->args[2]) : 20000;
+        if (threads < 1) {
+            printf("usage: mydev stress [threads] [calls]\n");
+            last_status = 2;
+            return SUCCESS;
+        }
+        if (threads > MYDEV_STRESS_MAX_THREADS)
+            threads = MYDEV_STRESS_MAX_THREADS;
+        if (mydev_stress(threads, calls > 0 ? calls : 20000) == -1)
+            last_status = 1;
+    }
 
+    if (r == -1) {
+        printf("-%s: mydev: %s: %s\n", sysname, action, strerror(errno));
+        last_status = 1;
+    }
+    return SUCCESS;
+}
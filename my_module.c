@@ -7,16 +7,88 @@
 #include<linux/device.h>
 #include<linux/slab.h>
 #include<linux/uaccess.h>
+#include<linux/uio.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
+#include<linux/mm.h>
+#include<linux/mutex.h>
+#include<linux/proc_fs.h>
+#include<linux/seq_file.h>
+#include<linux/sched.h>
+#include<linux/sched/task.h>
+#include<linux/rcupdate.h>
+#include<linux/pid.h>
+#include<linux/percpu.h>
+#include<linux/ktime.h>
+#include<linux/debugfs.h>
+
+#include "my_module.h"
+
+#define CREATE_TRACE_POINTS
+#include "my_trace.h"
+
+/* The buffer is a list of pages that grows up to MY_MAX_SIZE. A page
+*  is allocated zeroed the first time it is written or mapped and is kept
+*  until the module goes away, so a reader finds either NULL (a hole,
+*  read as zeros) or a page that stays valid. Pages are installed with
+*  cmpxchg and never under my_lock, which protects the ring offsets and
+*  the length of the data.
+*/
+
+#define MY_MAX_PAGES (MY_MAX_SIZE >> PAGE_SHIFT)
+
+static struct page **my_pages;
+static size_t my_data_len;
+static struct my_offsets my_ring;
+static DEFINE_MUTEX(my_lock);
+
+/* Files in channel mode sleep here for data and for room in the ring */
+static DECLARE_WAIT_QUEUE_HEAD(my_readable);
+static DECLARE_WAIT_QUEUE_HEAD(my_writable);
+
+/* State of one open file, from its own slab cache. Its lock serializes
+*  the calls made through that file, which share the file offset; it is
+*  always taken before my_lock. Channel mode does not use the offset and
+*  only takes my_lock.
+*/
+struct my_file {
+	struct mutex lock;
+	bool channel;
+	u64 bytes_read;
+	u64 bytes_written;
+};
+
+static struct kmem_cache *my_file_cache;
 
-/* TODO 1: define the size of the dynamically 
-*  allocated memory region as a macro here and
-*  declare the global pointer variable that will 
-*  point to a dynamically allocated memory block
+/* Statistics, kept per CPU so that the hot path never shares a cache
+*  line, and summed only when /sys/kernel/debug/my_module/stats is read.
+*  Bucket b of a histogram counts the calls that took less than 2^b ns
+*  and at least 2^(b-1), the last one everything slower.
 */
+enum my_op { MY_OP_OPEN, MY_OP_READ, MY_OP_WRITE, MY_NR_OPS };
+
+#define MY_HIST_BUCKETS 40
+
+struct my_stats {
+	u64 calls[MY_NR_OPS];
+	u64 errors[MY_NR_OPS];
+	u64 bytes[MY_NR_OPS];
+	u64 hist[MY_NR_OPS][MY_HIST_BUCKETS];
+};
 
-#define SIZE 200
+static DEFINE_PER_CPU(struct my_stats, my_cpu_stats);
+static struct dentry *my_debugfs;
 
-void* my_pointer;
+/* Counts one call of op that returned ret after ns nanoseconds */
+static void my_account(enum my_op op, ssize_t ret, u64 ns)
+{
+	this_cpu_inc(my_cpu_stats.calls[op]);
+	if (ret < 0)
+		this_cpu_inc(my_cpu_stats.errors[op]);
+	else if (op != MY_OP_OPEN)
+		this_cpu_add(my_cpu_stats.bytes[op], ret);
+	this_cpu_inc(my_cpu_stats.hist[op][min(fls64(ns), MY_HIST_BUCKETS - 1)]);
+}
 
 dev_t dev = 0;
 
@@ -29,69 +101,688 @@ static int __init my_driver_init(void);
 static void __exit my_driver_exit(void);
 static int my_open(struct inode *inode, struct file *file);
 static int my_release(struct inode *inode, struct file *file);
-static ssize_t my_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
-static ssize_t my_write(struct file *filp, const char *buf, size_t len, loff_t *off);
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static loff_t my_llseek(struct file *filp, loff_t offset, int whence);
+static __poll_t my_poll(struct file *filp, poll_table *wait);
+static int my_mmap(struct file *filp, struct vm_area_struct *vma);
+static long my_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 
 static struct file_operations fops = 
 {
 	.owner	= THIS_MODULE,
-	.read 	= my_read,
-	.write	= my_write,
+	.read_iter = my_read_iter,
+	.write_iter = my_write_iter,
+	.llseek	= my_llseek,
+	.poll	= my_poll,
 	.open	= my_open,
 	.release = my_release, 
+	.mmap	= my_mmap,
+	.unlocked_ioctl = my_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
 };
 
 static int my_open(struct inode *inode, struct file * file)
 {	
-/* TODO 2: dynamically allocate a single block 
-*  of memory region here
+	u64 start = ktime_get_ns();
+	struct my_file *state;
+	int ret = 0;
+
+	state = kmem_cache_zalloc(my_file_cache, GFP_KERNEL);
+	if (state) {
+		mutex_init(&state->lock);
+		file->private_data = state;
+	} else {
+		ret = -ENOMEM;
+	}
+
+	my_account(MY_OP_OPEN, ret, ktime_get_ns() - start);
+	trace_my_open(ret);
+	return ret;
+}
+
+static int my_release(struct inode *inode, struct file *file)
+{
+	struct my_file *state = file->private_data;
+
+	trace_my_release(state->bytes_read, state->bytes_written);
+	kmem_cache_free(my_file_cache, state);
+	return 0;
+}
+
+/* Page index of the buffer, allocated if create is set and it is still
+*  a hole. Returns NULL for a hole, or when allocation fails.
 */
-	printk(KERN_INFO "my_open function is called");
+static struct page *my_page(pgoff_t index, bool create)
+{
+	struct page *page = READ_ONCE(my_pages[index]);
+	struct page *old;
+
+	if (page || !create)
+		return page;
+	page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+	if (!page)
+		return NULL;
+	old = cmpxchg(&my_pages[index], NULL, page);
+	if (old) {
+		__free_page(page);
+		return old;
+	}
+	return page;
+}
 
-	my_pointer = kmalloc(SIZE,GFP_KERNEL);
-	if(my_pointer != NULL){
-		printk(KERN_INFO "Memory Allocated Succesfully. \n");
+static void my_pages_free(void)
+{
+	size_t i;
+
+	if (!my_pages)
+		return;
+	for (i = 0; i < MY_MAX_PAGES; i++)
+		if (my_pages[i])
+			__free_page(my_pages[i]);
+	kvfree(my_pages);
+}
+
+/* Copies len bytes of the buffer at pos into to, or from from into the
+*  buffer. In the ring pos is a ring offset and the copy wraps around
+*  MY_BUF_SIZE. Both return the bytes copied and set *err when that is
+*  short of len.
+*/
+static size_t my_copy_out(u64 pos, size_t len, bool ring, struct iov_iter *to, int *err)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		u64 at = ring ? (pos + done) & (MY_BUF_SIZE - 1) : pos + done;
+		size_t in_page = at & ~PAGE_MASK;
+		size_t n = min_t(size_t, len - done, PAGE_SIZE - in_page);
+		struct page *page = my_page(at >> PAGE_SHIFT, false);
+		size_t copied = page ? copy_page_to_iter(page, in_page, n, to) : iov_iter_zero(n, to);
+
+		done += copied;
+		if (copied < n) {
+			*err = -EFAULT;
+			break;
+		}
 	}
-	return 0;
+	return done;
 }
 
-static int my_release(struct inode *inode, struct file *file)
+static size_t my_copy_in(u64 pos, size_t len, bool ring, struct iov_iter *from, int *err)
 {
-/* TODO 3: free the dynamically allocated memory region here 
+	size_t done = 0;
+
+	while (done < len) {
+		u64 at = ring ? (pos + done) & (MY_BUF_SIZE - 1) : pos + done;
+		size_t in_page = at & ~PAGE_MASK;
+		size_t n = min_t(size_t, len - done, PAGE_SIZE - in_page);
+		struct page *page = my_page(at >> PAGE_SHIFT, true);
+		size_t copied;
+
+		if (!page) {
+			*err = -ENOMEM;
+			break;
+		}
+		copied = copy_page_from_iter(page, in_page, n, from);
+		done += copied;
+		if (copied < n) {
+			*err = -EFAULT;
+			break;
+		}
+	}
+	return done;
+}
+
+static u64 my_ring_used(void)
+{
+	return READ_ONCE(my_ring.tail) - READ_ONCE(my_ring.head);
+}
+
+/* Channel mode: the ring is a bounded pipe. A read takes what has been
+*  published, a write what fits, and each sleeps while there is nothing
+*  to take or no room, unless the file is O_NONBLOCK.
 */
-	printk(KERN_INFO "my_release is called.");
-	kfree(my_pointer);
+static ssize_t my_channel_read(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct my_file *state = iocb->ki_filp->private_data;
+	size_t done;
+	int err = 0;
+
+	if (!iov_iter_count(to))
+		return 0;
+	for (;;) {
+		mutex_lock(&my_lock);
+		if (my_ring.tail != my_ring.head)
+			break;
+		mutex_unlock(&my_lock);
+		if (iocb->ki_filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(my_readable, my_ring_used() != 0))
+			return -ERESTARTSYS;
+	}
 
-	printk(KERN_INFO "Memory has been freed.");
-	return 0;
+	done = my_copy_out(my_ring.head, min_t(u64, iov_iter_count(to), my_ring.tail - my_ring.head),
+			   true, to, &err);
+	my_ring.head += done;
+	state->bytes_read += done;
+	mutex_unlock(&my_lock);
+
+	if (!done)
+		return err;
+	wake_up_interruptible(&my_writable);
+	return done;
 }
 
-static ssize_t my_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+static ssize_t my_channel_write(struct kiocb *iocb, struct iov_iter *from)
 {
-/* TODO 4: make the user application read the content of
-*  the dynamically allocated memory region here
+	struct my_file *state = iocb->ki_filp->private_data;
+	size_t done;
+	int err = 0;
+
+	if (!iov_iter_count(from))
+		return 0;
+	for (;;) {
+		mutex_lock(&my_lock);
+		if (my_ring.tail - my_ring.head < MY_BUF_SIZE)
+			break;
+		mutex_unlock(&my_lock);
+		if (iocb->ki_filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(my_writable, my_ring_used() < MY_BUF_SIZE))
+			return -ERESTARTSYS;
+	}
+
+	done = my_copy_in(my_ring.tail,
+			  min_t(u64, iov_iter_count(from), MY_BUF_SIZE - (my_ring.tail - my_ring.head)),
+			  true, from, &err);
+	my_ring.tail += done;
+	state->bytes_written += done;
+	mutex_unlock(&my_lock);
+
+	if (!done)
+		return err;
+	wake_up_interruptible(&my_readable);
+	return done;
+}
+
+/* read and write move a whole iov_iter, so readv/writev and large
+*  pread/pwrite take one call. my_lock is held across the copies: the
+*  user buffer may be a mapping of the device itself, but my_fault never
+*  takes the lock, so faulting it in cannot deadlock.
 */
+static ssize_t my_file_read(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct my_file *state = iocb->ki_filp->private_data;
+	size_t done;
+	ssize_t ret = 0;
+	int err = 0;
+	loff_t pos;
+
+	mutex_lock(&state->lock);
+	mutex_lock(&my_lock);
+	pos = iocb->ki_pos;
+	if (pos < 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (pos >= my_data_len)
+		goto out;
+
+	done = my_copy_out(pos, min_t(size_t, iov_iter_count(to), my_data_len - pos), false, to, &err);
+	ret = err;
+	if (done) {
+		iocb->ki_pos = pos + done;
+		state->bytes_read += done;
+		ret = done;
+	}
+out:
+	mutex_unlock(&my_lock);
+	mutex_unlock(&state->lock);
+	return ret;
+}
 
-	printk(KERN_INFO "my_read is called");
+static ssize_t my_file_write(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct my_file *state = iocb->ki_filp->private_data;
+	size_t len = iov_iter_count(from), done;
+	ssize_t ret = 0;
+	int err = 0;
+	loff_t pos;
+
+	mutex_lock(&state->lock);
+	mutex_lock(&my_lock);
+	pos = iocb->ki_flags & IOCB_APPEND ? my_data_len : iocb->ki_pos;
+	if (pos < 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (pos >= MY_MAX_SIZE) {
+		ret = len ? -ENOSPC : 0;
+		goto out;
+	}
 
-	//strncpy_from_user(buf, my_pointer, len);
-	return len;
+	done = my_copy_in(pos, min_t(size_t, len, MY_MAX_SIZE - pos), false, from, &err);
+	ret = err;
+	if (done) {
+		if (pos + done > my_data_len)
+			my_data_len = pos + done;
+		iocb->ki_pos = pos + done;
+		state->bytes_written += done;
+		ret = done;
+	}
+out:
+	mutex_unlock(&my_lock);
+	mutex_unlock(&state->lock);
+	return ret;
+}
+
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct my_file *state = iocb->ki_filp->private_data;
+	bool channel = READ_ONCE(state->channel);
+	size_t len = iov_iter_count(to);
+	u64 start = ktime_get_ns();
+	ssize_t ret = channel ? my_channel_read(iocb, to) : my_file_read(iocb, to);
+	u64 ns = ktime_get_ns() - start;
+
+	my_account(MY_OP_READ, ret, ns);
+	trace_my_read(channel, len, ret, ns);
+	return ret;
 }
 
-static ssize_t my_write(struct file *filp,const char __user *buf, size_t len, loff_t* off)
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct my_file *state = iocb->ki_filp->private_data;
+	bool channel = READ_ONCE(state->channel);
+	size_t len = iov_iter_count(from);
+	u64 start = ktime_get_ns();
+	ssize_t ret = channel ? my_channel_write(iocb, from) : my_file_write(iocb, from);
+	u64 ns = ktime_get_ns() - start;
+
+	my_account(MY_OP_WRITE, ret, ns);
+	trace_my_write(channel, len, ret, ns);
+	return ret;
+}
+
+/* A file in channel mode is readable while the ring holds data and
+*  writable while it has room. Plain reads and writes never block.
+*/
+static __poll_t my_poll(struct file *filp, poll_table *wait)
 {
-/* TODO 5: make the user application write to
-*  the dynamically allocated memory region here
+	struct my_file *state = filp->private_data;
+	__poll_t mask = 0;
+	u64 used;
+
+	if (!READ_ONCE(state->channel))
+		return DEFAULT_POLLMASK;
+	poll_wait(filp, &my_readable, wait);
+	poll_wait(filp, &my_writable, wait);
+	used = my_ring_used();
+	if (used)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (used < MY_BUF_SIZE)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+/* SEEK_END, SEEK_DATA and SEEK_HOLE go by the length of the data; any
+*  offset up to MY_MAX_SIZE can be reached.
 */
-	printk(KERN_INFO "my_write is called");
+static loff_t my_llseek(struct file *filp, loff_t offset, int whence)
+{
+	loff_t size;
 
+	mutex_lock(&my_lock);
+	size = my_data_len;
+	mutex_unlock(&my_lock);
+	return generic_file_llseek_size(filp, offset, whence, MY_MAX_SIZE, size);
+}
 
-	copy_from_user(my_pointer, buf, len);
-	
-	printk("This is written %s",(char *)my_pointer);
+/* Mapped pages are the driver's own, so whatever one side writes the
+*  other sees without a copy. They are handed out one fault at a time,
+*  and a hole gets its page on first touch.
+*/
+static vm_fault_t my_fault(struct vm_fault *vmf)
+{
+	struct page *page;
+
+	if (vmf->pgoff >= MY_MAX_PAGES)
+		return VM_FAULT_SIGBUS;
+	page = my_page(vmf->pgoff, true);
+	if (!page)
+		return VM_FAULT_OOM;
+	get_page(page);
+	vmf->page = page;
+	return 0;
+}
+
+static const struct vm_operations_struct my_vm_ops = {
+	.fault	= my_fault,
+};
+
+static int my_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff > MY_MAX_PAGES || vma_pages(vma) > MY_MAX_PAGES - vma->vm_pgoff)
+		return -EINVAL;
+	vma->vm_ops = &my_vm_ops;
+	return 0;
+}
+
+static long my_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct my_file *state = filp->private_data;
+	struct my_offsets offsets;
+	__u64 value;
+	long ret = 0;
+	int on;
+
+	switch (cmd) {
+	case MY_IOC_CHANNEL:
+		if (get_user(on, (int __user *)arg))
+			return -EFAULT;
+		WRITE_ONCE(state->channel, on != 0);
+		return 0;
+	case MY_IOC_GET_OFFSETS:
+		mutex_lock(&my_lock);
+		offsets = my_ring;
+		mutex_unlock(&my_lock);
+		if (copy_to_user((void __user *)arg, &offsets, sizeof(offsets)))
+			return -EFAULT;
+		return 0;
+	case MY_IOC_SET_HEAD:
+	case MY_IOC_SET_TAIL:
+		if (copy_from_user(&value, (void __user *)arg, sizeof(value)))
+			return -EFAULT;
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	/* Offsets only move forward, the consumer never passes the producer
+	*  and the producer never gets a whole buffer ahead of the consumer.
+	*/
+	mutex_lock(&my_lock);
+	if (cmd == MY_IOC_SET_HEAD) {
+		if (value < my_ring.head || value > my_ring.tail)
+			ret = -EINVAL;
+		else
+			my_ring.head = value;
+	} else {
+		if (value < my_ring.tail || value - my_ring.head > MY_BUF_SIZE)
+			ret = -EINVAL;
+		else
+			my_ring.tail = value;
+	}
+	mutex_unlock(&my_lock);
+
+	/* Producers and consumers on the mapping wake channel files too */
+	if (ret == 0)
+		wake_up_interruptible(cmd == MY_IOC_SET_HEAD ? &my_writable : &my_readable);
+	return ret;
+}
+
+static const char *const my_op_names[MY_NR_OPS] = { "open", "read", "write" };
+
+static int my_stats_show(struct seq_file *m, void *v)
+{
+	struct my_stats *sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	int cpu, op, b;
+
+	if (!sum)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		struct my_stats *s = per_cpu_ptr(&my_cpu_stats, cpu);
+
+		for (op = 0; op < MY_NR_OPS; op++) {
+			sum->calls[op] += READ_ONCE(s->calls[op]);
+			sum->errors[op] += READ_ONCE(s->errors[op]);
+			sum->bytes[op] += READ_ONCE(s->bytes[op]);
+			for (b = 0; b < MY_HIST_BUCKETS; b++)
+				sum->hist[op][b] += READ_ONCE(s->hist[op][b]);
+		}
+	}
+
+	for (op = 0; op < MY_NR_OPS; op++)
+		seq_printf(m, "%-5s calls %llu errors %llu bytes %llu\n", my_op_names[op],
+			   sum->calls[op], sum->errors[op], sum->bytes[op]);
+	for (op = 0; op < MY_NR_OPS; op++) {
+		seq_printf(m, "\n%s latency:\n", my_op_names[op]);
+		for (b = 0; b < MY_HIST_BUCKETS; b++)
+			if (sum->hist[op][b])
+				seq_printf(m, "  < %llu ns: %llu\n", 1ULL << b, sum->hist[op][b]);
+	}
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(my_stats);
+
+/* Any write to the reset file zeroes the statistics of every CPU. Calls
+*  running meanwhile may be counted or not.
+*/
+static ssize_t my_reset_write(struct file *file, const char __user *buf, size_t len, loff_t *off)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&my_cpu_stats, cpu), 0, sizeof(struct my_stats));
+	return len;
+}
+
+static const struct file_operations my_reset_fops = {
+	.owner	= THIS_MODULE,
+	.write	= my_reset_write,
+	.llseek	= noop_llseek,
+};
+
+/* pstraverse: a snapshot of the process tree below one task, streamed to
+*  the reader with seq_file. The root is looked up under RCU and the
+*  children lists are followed under read_lock(&tasklist_lock), which
+*  fork and exit take for writing, so the snapshot is consistent.
+*/
+
+struct pst_entry {
+	pid_t pid;
+	pid_t ppid;
+	int depth;
+	char comm[TASK_COMM_LEN];
+};
+
+struct pst_work {
+	struct task_struct *task;
+	pid_t ppid;
+	int depth;
+};
+
+/* State of one open /proc/pstraverse */
+struct pst_query {
+	pid_t root;
+	bool bfs;
+	bool done;
+	struct pst_entry *entries;
+	size_t count;
+};
+
+/* Walks the tree into q->entries. The arrays cannot grow while
+*  tasklist_lock is held, so a walk that does not fit starts over with
+*  more room.
+*/
+static int pst_snapshot(struct pst_query *q)
+{
+	size_t cap = 1024;
+
+	for (;;) {
+		struct pst_entry *entries = kvmalloc_array(cap, sizeof(*entries), GFP_KERNEL);
+		struct pst_work *work = kvmalloc_array(cap, sizeof(*work), GFP_KERNEL);
+		struct task_struct *task, *child;
+		size_t count = 0, head = 0, tail = 0;
+		bool full = false;
+
+		if (!entries || !work) {
+			kvfree(entries);
+			kvfree(work);
+			return -ENOMEM;
+		}
+
+		/* RCU covers the pid lookup, but the children and sibling
+		*  lists change under write_lock(&tasklist_lock) on fork and
+		*  exit, so the walk holds it for reading. That also keeps every
+		*  task in the work list from being released while it is queued.
+		*/
+		read_lock(&tasklist_lock);
+		rcu_read_lock();
+		task = pid_task(find_vpid(q->root), PIDTYPE_PID);
+		rcu_read_unlock();
+		if (!task) {
+			read_unlock(&tasklist_lock);
+			kvfree(entries);
+			kvfree(work);
+			return -ESRCH;
+		}
+		work[tail++] = (struct pst_work){ task, 0, 0 };
+
+		/* BFS takes work from the front, DFS from the back. DFS pushes
+		*  the children last to first so that they come out in order.
+		*/
+		while (head < tail && !full) {
+			struct pst_work w = q->bfs ? work[head++] : work[--tail];
+			struct pst_entry *e;
+
+			if (count == cap) {
+				full = true;
+				break;
+			}
+			e = &entries[count++];
+			e->pid = task_pid_vnr(w.task);
+			e->ppid = w.ppid;
+			e->depth = w.depth;
+			get_task_comm(e->comm, w.task);
+
+			if (q->bfs) {
+				list_for_each_entry(child, &w.task->children, sibling) {
+					if (tail == cap) {
+						full = true;
+						break;
+					}
+					work[tail++] = (struct pst_work){ child, e->pid, w.depth + 1 };
+				}
+			} else {
+				list_for_each_entry_reverse(child, &w.task->children, sibling) {
+					if (tail == cap) {
+						full = true;
+						break;
+					}
+					work[tail++] = (struct pst_work){ child, e->pid, w.depth + 1 };
+				}
+			}
+		}
+		read_unlock(&tasklist_lock);
+
+		kvfree(work);
+		if (!full) {
+			kvfree(q->entries);
+			q->entries = entries;
+			q->count = count;
+			q->done = true;
+			return 0;
+		}
+		kvfree(entries);
+		cap *= 4;
+	}
+}
+
+static void *pst_start(struct seq_file *m, loff_t *pos)
+{
+	struct pst_query *q = m->private;
+
+	if (*pos == 0 && !q->done) {
+		int ret = pst_snapshot(q);
+		if (ret)
+			return ERR_PTR(ret);
+	}
+	return *pos < q->count ? &q->entries[*pos] : NULL;
+}
+
+static void *pst_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct pst_query *q = m->private;
+
+	++*pos;
+	return *pos < q->count ? &q->entries[*pos] : NULL;
+}
+
+static void pst_stop(struct seq_file *m, void *v)
+{
+}
+
+static int pst_show(struct seq_file *m, void *v)
+{
+	struct pst_entry *e = v;
+
+	seq_printf(m, "%d %d %d %s\n", e->depth, e->pid, e->ppid, e->comm);
+	return 0;
+}
+
+static const struct seq_operations pst_seq_ops = {
+	.start	= pst_start,
+	.next	= pst_next,
+	.stop	= pst_stop,
+	.show	= pst_show,
+};
+
+static int pst_open(struct inode *inode, struct file *file)
+{
+	struct pst_query *q = __seq_open_private(file, &pst_seq_ops, sizeof(*q));
+
+	if (!q)
+		return -ENOMEM;
+	q->root = 1;
+	return 0;
+}
+
+/* "<pid> dfs|bfs" picks the walk the next read returns */
+static ssize_t pst_write(struct file *file, const char __user *buf, size_t len, loff_t *off)
+{
+	struct seq_file *m = file->private_data;
+	struct pst_query *q = m->private;
+	char kbuf[32], mode[4] = "dfs";
+	int pid;
+
+	if (len >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, len))
+		return -EFAULT;
+	kbuf[len] = 0;
+	if (sscanf(kbuf, "%d %3s", &pid, mode) < 1 || pid <= 0)
+		return -EINVAL;
+	if (strcmp(mode, "dfs") != 0 && strcmp(mode, "bfs") != 0)
+		return -EINVAL;
+
+	/* seq_read holds m->lock while pst_start and pst_next use the query */
+	mutex_lock(&m->lock);
+	q->root = pid;
+	q->bfs = mode[0] == 'b';
+	q->done = false;
+	mutex_unlock(&m->lock);
 	return len;
 }
 
+static int pst_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+	struct pst_query *q = m->private;
+
+	kvfree(q->entries);
+	return seq_release_private(inode, file);
+}
+
+static const struct proc_ops pst_proc_ops = {
+	.proc_open	= pst_open,
+	.proc_read	= seq_read,
+	.proc_write	= pst_write,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= pst_release,
+};
+
 static int __init my_driver_init(void)
 {
 	/* Allocating Major number dynamically*/
@@ -99,6 +790,17 @@ static int __init my_driver_init(void)
 	/* <0 to check if major number is created */
 	if((alloc_chrdev_region(&dev, 0, 1, "my_Dev")) < 0) {
 		printk(KERN_INFO"Cannot allocate the major number...\n");
+		return -1;
+	}
+
+	my_pages = kvcalloc(MY_MAX_PAGES, sizeof(*my_pages), GFP_KERNEL);
+	my_file_cache = KMEM_CACHE(my_file, 0);
+	if (my_pages == NULL || my_file_cache == NULL) {
+		printk(KERN_INFO "Cannot allocate the buffer...\n");
+		kmem_cache_destroy(my_file_cache);
+		kvfree(my_pages);
+		unregister_chrdev_region(dev, 1);
+		return -ENOMEM;
 	}
 
 	printk(KERN_INFO"Major = %d Minor =  %d..\n", MAJOR(dev),MINOR(dev));
@@ -125,22 +827,41 @@ static int __init my_driver_init(void)
 		goto r_device;
 	}
 
+	if (proc_create("pstraverse", 0666, NULL, &pst_proc_ops) == NULL) {
+		printk(KERN_INFO " cannot create /proc/pstraverse ..\n");
+		goto r_proc;
+	}
+
+	/* Statistics are optional, the driver works without debugfs */
+	my_debugfs = debugfs_create_dir("my_module", NULL);
+	debugfs_create_file("stats", 0444, my_debugfs, NULL, &my_stats_fops);
+	debugfs_create_file("reset", 0200, my_debugfs, NULL, &my_reset_fops);
+
 	printk(KERN_INFO"Device driver insert...done properly...");
 	return 0;
 
+r_proc:
+	device_destroy(dev_class, dev);
 r_device: 
 	class_destroy(dev_class);
 
 r_class:
+	cdev_del(&my_cdev);
+	kmem_cache_destroy(my_file_cache);
+	my_pages_free();
 	unregister_chrdev_region(dev, 1);
 	return -1;
 }
 
 void __exit my_driver_exit(void) {
+	debugfs_remove_recursive(my_debugfs);
+	remove_proc_entry("pstraverse", NULL);
 	device_destroy(dev_class, dev);
 	class_destroy(dev_class);
 	cdev_del(&my_cdev);
 	unregister_chrdev_region(dev, 1);
+	kmem_cache_destroy(my_file_cache);
+	my_pages_free();
 	printk(KERN_INFO "Device driver is removed successfully...\n");
 }
 
@@ -0,0 +1,50 @@
+/*
+ * Interface of /dev/my_device shared by the module and the shell.
+ *
+ * The device holds a buffer of up to MY_MAX_SIZE bytes that can be read
+ * and written at any offset (readv/writev and lseek included) and mapped
+ * with mmap(); its pages are allocated as they are first written. The
+ * first MY_BUF_SIZE bytes can also be used as a ring between a producer
+ * and a consumer that both work on the mapping: the producer copies
+ * bytes in at tail and publishes them with MY_IOC_SET_TAIL, the consumer
+ * reads from head up to tail and releases them with MY_IOC_SET_HEAD.
+ * Offsets only grow, the byte of offset o is at o % MY_BUF_SIZE in the
+ * buffer.
+ *
+ * MY_IOC_CHANNEL with a nonzero int puts one open file in channel mode,
+ * where read() and write() work on the ring instead of the file offset:
+ * a read consumes from head, a write appends at tail, and either blocks
+ * while the ring is empty or full (EAGAIN under O_NONBLOCK). poll()
+ * reports POLLIN while the ring holds data and POLLOUT while it has
+ * room, also for bytes moved through the mapping with the ioctls.
+ */
+#ifndef MY_MODULE_H
+#define MY_MODULE_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define MY_DEVICE_PATH "/dev/my_device"
+#define MY_BUF_SIZE (1 << 20)
+#define MY_MAX_SIZE (64 << 20)
+
+struct my_offsets {
+	__u64 head; /* first byte not consumed yet */
+	__u64 tail; /* end of the published bytes */
+};
+
+/*
+ * Process tree walk. Write "<pid> dfs" or "<pid> bfs" to PSTRAVERSE_PATH
+ * and read the result back from the same open file, one task per line
+ * in traversal order: "<depth> <pid> <parent pid> <comm>". The root has
+ * depth 0 and parent pid 0.
+ */
+#define PSTRAVERSE_PATH "/proc/pstraverse"
+
+#define MY_IOC_MAGIC 'm'
+#define MY_IOC_GET_OFFSETS _IOR(MY_IOC_MAGIC, 1, struct my_offsets)
+#define MY_IOC_SET_HEAD _IOW(MY_IOC_MAGIC, 2, __u64)
+#define MY_IOC_SET_TAIL _IOW(MY_IOC_MAGIC, 3, __u64)
+#define MY_IOC_CHANNEL _IOW(MY_IOC_MAGIC, 4, int)
+
+#endif
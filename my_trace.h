@@ -0,0 +1,74 @@
+/*
+ * Tracepoints of my_module, under events/my_module in tracefs. They
+ * replace the printk on every open, read and write and cost nothing
+ * while disabled.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM my_module
+
+#if !defined(_MY_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MY_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(my_open,
+	TP_PROTO(int ret),
+	TP_ARGS(ret),
+	TP_STRUCT__entry(
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->ret = ret;
+	),
+	TP_printk("ret=%d", __entry->ret)
+);
+
+TRACE_EVENT(my_release,
+	TP_PROTO(u64 bytes_read, u64 bytes_written),
+	TP_ARGS(bytes_read, bytes_written),
+	TP_STRUCT__entry(
+		__field(u64, bytes_read)
+		__field(u64, bytes_written)
+	),
+	TP_fast_assign(
+		__entry->bytes_read = bytes_read;
+		__entry->bytes_written = bytes_written;
+	),
+	TP_printk("read=%llu written=%llu", __entry->bytes_read, __entry->bytes_written)
+);
+
+DECLARE_EVENT_CLASS(my_io,
+	TP_PROTO(bool channel, size_t len, ssize_t ret, u64 ns),
+	TP_ARGS(channel, len, ret, ns),
+	TP_STRUCT__entry(
+		__field(bool, channel)
+		__field(size_t, len)
+		__field(ssize_t, ret)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->channel = channel;
+		__entry->len = len;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+	TP_printk("%s len=%zu ret=%zd ns=%llu", __entry->channel ? "channel" : "file",
+		  __entry->len, __entry->ret, __entry->ns)
+);
+
+DEFINE_EVENT(my_io, my_read,
+	TP_PROTO(bool channel, size_t len, ssize_t ret, u64 ns),
+	TP_ARGS(channel, len, ret, ns)
+);
+
+DEFINE_EVENT(my_io, my_write,
+	TP_PROTO(bool channel, size_t len, ssize_t ret, u64 ns),
+	TP_ARGS(channel, len, ret, ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE my_trace
+#include <trace/define_trace.h>